@@ -0,0 +1,594 @@
+/* Host benchmark for the root data path.
+ *
+ * The firmware's queue, uploader, batcher, caches, spool and wire decoder run unchanged on top of
+ * the pthread shims in port/. A generator thread plays the mesh receive task: it encodes readings
+ * from simulated sensors into mesh frames and hands them to root_ingest(). A local keep-alive HTTP
+ * server plays the patient API, with configurable latency and error injection, and reports when
+ * each reading arrives.
+ *
+ *   cmake -S bench -B bench/build && cmake --build bench/build
+ *   ./bench/build/neolink_bench --sensors 40 --rate 5 --duration 10 --latency-ms 30
+ */
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "dedup.h"
+#include "deflate.h"
+#include "flow.h"
+#include "http_pool.h"
+#include "metrics.h"
+#include "neo_wire.h"
+#include "root.h"
+#include "trace.h"
+#include "fake_server.h"
+#include "port.h"
+
+#define BENCH_WARMUP_US 1000000LL //connections, DNS and the patient cache settle in this long
+
+typedef struct {
+    int sensors;
+    double rate; //readings per second per sensor
+    int duration_s;
+    int per_frame; //readings a sensor packs into one mesh frame
+    bool legacy; //send the fixed mesh_message_t struct instead of neo_wire frames
+    int critical_every; //flag every Nth frame as critical, 0 for none
+    int handoff_at_s; //hand the root role over after this many seconds, 0 for never
+    double duplicate_rate; //fraction of frames the mesh delivers twice
+    bool flow; //sensors follow the root's flow control hints
+    bool spool;
+    int tasks;
+    int pool;
+    int batch_items; //0 uploads every reading on its own
+    int batch_delay_ms;
+    deflate_format_t encoding; //Content-Encoding for bulk bodies
+    int compress_min; //bulk bodies shorter than this go uncompressed
+    bool check_allocs; //fail if the root data path allocates after the warm-up
+    fake_server_config_t server;
+} bench_options_t;
+
+static int64_t *sent_us; //injection time per sequence number
+static int64_t *arrived_us; //first arrival at the server, 0 until then
+static bool *critical; //sent in a critical frame
+static uint32_t max_readings;
+static pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t delivered = 0;
+static uint32_t duplicates = 0;
+static int64_t last_arrival_us = 0;
+static const root_config_t *root_config;
+static uint8_t *handoff_buf; //frames sent by the yielding root, each prefixed with its length
+static size_t handoff_len, handoff_cap;
+static uint32_t handoff_frames;
+static root_handoff_stats_t handoff_stats;
+static int64_t handoff_us; //from yielding to the new root having ingested everything
+static uint32_t frames_sent = 0;
+static int stretch_max = 1;
+static uint64_t warmup_allocs; //heap allocations by the root until the warm-up ended
+static uint64_t steady_allocs; //and from then to the end of the load
+static uint32_t steady_readings; //readings produced in that time
+
+static void on_reading(uint32_t seq)
+{
+    int64_t now = esp_timer_get_time();
+    pthread_mutex_lock(&results_lock);
+    if (seq >= max_readings || sent_us[seq] == 0) {
+        // not one of ours
+    } else if (arrived_us[seq] != 0) {
+        duplicates++;
+    } else {
+        arrived_us[seq] = now;
+        delivered++;
+        last_arrival_us = now;
+    }
+    pthread_mutex_unlock(&results_lock);
+}
+
+static esp_err_t capture_handoff(void *ctx, const uint8_t *frame, size_t len)
+{
+    if (handoff_len + sizeof(uint16_t) + len > handoff_cap) {
+        size_t cap = handoff_cap * 2 + sizeof(uint16_t) + len;
+        uint8_t *buf = realloc(handoff_buf, cap);
+        if (buf == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        handoff_buf = buf;
+        handoff_cap = cap;
+    }
+    uint16_t n = len;
+    memcpy(handoff_buf + handoff_len, &n, sizeof(n));
+    memcpy(handoff_buf + handoff_len + sizeof(n), frame, len);
+    handoff_len += sizeof(n) + len;
+    handoff_frames++;
+    return ESP_OK;
+}
+
+/* Root switch within one process: the root yields into a capture buffer, takes the role back as the
+ * "new" root and ingests what was handed over, the way the next root would receive it over the mesh. */
+static void handoff(void)
+{
+    int64_t start = esp_timer_get_time();
+    root_yield(capture_handoff, NULL, &handoff_stats);
+    ESP_ERROR_CHECK(root_start(root_config));
+    for (size_t off = 0; off < handoff_len;) {
+        uint16_t len;
+        root_ingest_result_t result;
+        memcpy(&len, handoff_buf + off, sizeof(len));
+        root_ingest(handoff_buf + off + sizeof(len), len, &result);
+        off += sizeof(len) + len;
+    }
+    handoff_us = esp_timer_get_time() - start;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --sensors N        simulated sensors (20)\n"
+            "  --rate R           readings per second per sensor (5)\n"
+            "  --duration S       seconds of load (10)\n"
+            "  --per-frame N      readings per mesh frame (1)\n"
+            "  --legacy           send fixed 192-byte structs instead of neo_wire frames\n"
+            "  --critical-every N flag every Nth frame as a critical alert (0: none)\n"
+            "  --handoff-at S     hand the root role over after S seconds (0: never)\n"
+            "  --duplicate-rate F fraction of frames delivered twice (0)\n"
+            "  --flow             sensors pack more readings per frame when the root asks them to\n"
+            "  --latency-ms N     server latency per request (20)\n"
+            "  --jitter-ms N      extra random server latency (0)\n"
+            "  --error-rate F     fraction of requests answered with 503 (0)\n"
+            "  --close-every N    server closes the connection after N responses (0: never)\n"
+            "  --no-bulk          server rejects bulk uploads\n"
+            "  --chunked          server sends chunked responses in small segments\n"
+            "  --batch-items N    readings per bulk request, 0 to upload one by one (16)\n"
+            "  --batch-delay-ms N longest a reading waits for its batch (50)\n"
+            "  --encoding E       compress bulk bodies: none, gzip or deflate (none)\n"
+            "  --compress-min N   bulk bodies shorter than N bytes go uncompressed (512)\n"
+            "  --no-compress      server answers compressed bodies with 415\n"
+            "  --check-allocs     exit with 3 if the root allocates from the heap after the warm-up\n"
+            "  --tasks N          uploader tasks (2)\n"
+            "  --pool N           keep-alive connections, one kept for alerts if 2 or more (3)\n"
+            "  --spool            store and forward through the RAM flash partition\n"
+            "  --verbose          firmware logs at INFO\n",
+            prog);
+}
+
+static int parse_options(int argc, char **argv, bench_options_t *opt)
+{
+    static const struct option long_options[] = {
+        {"sensors", required_argument, NULL, 's'},
+        {"rate", required_argument, NULL, 'r'},
+        {"duration", required_argument, NULL, 'd'},
+        {"per-frame", required_argument, NULL, 'f'},
+        {"legacy", no_argument, NULL, 'L'},
+        {"critical-every", required_argument, NULL, 'A'},
+        {"handoff-at", required_argument, NULL, 'H'},
+        {"duplicate-rate", required_argument, NULL, 'R'},
+        {"flow", no_argument, NULL, 'F'},
+        {"latency-ms", required_argument, NULL, 'l'},
+        {"jitter-ms", required_argument, NULL, 'j'},
+        {"error-rate", required_argument, NULL, 'e'},
+        {"close-every", required_argument, NULL, 'c'},
+        {"no-bulk", no_argument, NULL, 'B'},
+        {"chunked", no_argument, NULL, 'C'},
+        {"batch-items", required_argument, NULL, 'b'},
+        {"batch-delay-ms", required_argument, NULL, 'D'},
+        {"encoding", required_argument, NULL, 'E'},
+        {"compress-min", required_argument, NULL, 'M'},
+        {"no-compress", no_argument, NULL, 'I'},
+        {"check-allocs", no_argument, NULL, 'Z'},
+        {"tasks", required_argument, NULL, 't'},
+        {"pool", required_argument, NULL, 'p'},
+        {"spool", no_argument, NULL, 'S'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (c) {
+        case 's': opt->sensors = atoi(optarg); break;
+        case 'r': opt->rate = atof(optarg); break;
+        case 'd': opt->duration_s = atoi(optarg); break;
+        case 'f': opt->per_frame = atoi(optarg); break;
+        case 'L': opt->legacy = true; break;
+        case 'A': opt->critical_every = atoi(optarg); break;
+        case 'H': opt->handoff_at_s = atoi(optarg); break;
+        case 'R': opt->duplicate_rate = atof(optarg); break;
+        case 'F': opt->flow = true; break;
+        case 'l': opt->server.latency_ms = atoi(optarg); break;
+        case 'j': opt->server.jitter_ms = atoi(optarg); break;
+        case 'e': opt->server.error_rate = atof(optarg); break;
+        case 'c': opt->server.close_every = atoi(optarg); break;
+        case 'B': opt->server.bulk = false; break;
+        case 'C': opt->server.chunked = true; break;
+        case 'b': opt->batch_items = atoi(optarg); break;
+        case 'D': opt->batch_delay_ms = atoi(optarg); break;
+        case 'E':
+            opt->encoding = strcmp(optarg, "gzip") == 0 ? DEFLATE_GZIP :
+                            strcmp(optarg, "deflate") == 0 ? DEFLATE_ZLIB :
+                            strcmp(optarg, "none") == 0 ? DEFLATE_NONE : -1;
+            break;
+        case 'M': opt->compress_min = atoi(optarg); break;
+        case 'I': opt->server.identity_only = true; break;
+        case 'Z': opt->check_allocs = true; break;
+        case 't': opt->tasks = atoi(optarg); break;
+        case 'p': opt->pool = atoi(optarg); break;
+        case 'S': opt->spool = true; break;
+        case 'v': esp_log_level_set("*", ESP_LOG_INFO); break;
+        default: usage(argv[0]); return -1;
+        }
+    }
+    if (opt->sensors < 1 || opt->sensors > 999 || opt->rate <= 0 || opt->duration_s < 1 ||
+            opt->per_frame < 1 || opt->per_frame > NEO_WIRE_MAX_READINGS || (opt->legacy && opt->per_frame != 1) ||
+            opt->critical_every < 0 || opt->handoff_at_s < 0 || (opt->legacy && opt->critical_every > 0) ||
+            opt->duplicate_rate < 0 || opt->duplicate_rate > 1 || (opt->legacy && opt->duplicate_rate > 0) ||
+            (opt->legacy && opt->flow) ||
+            opt->tasks < 1 || opt->tasks > UPLOADER_MAX_TASKS || opt->pool < 1 || opt->pool > HTTP_POOL_MAX_SIZE ||
+            opt->batch_items < 0 || opt->batch_items > BATCH_MAX_ITEMS ||
+            opt->encoding < DEFLATE_NONE || opt->encoding > DEFLATE_GZIP || opt->compress_min < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+// Encode frame `frame_seq` of `sensor`, holding `count` readings numbered from `seq`
+static size_t encode_frame(const bench_options_t *opt, int sensor, uint32_t frame_seq, uint32_t seq, int count,
+                           bool alert, uint8_t *frame)
+{
+    char sensor_id[16], patient_id[16];
+    snprintf(sensor_id, sizeof(sensor_id), "SEN-%03d", sensor);
+    snprintf(patient_id, sizeof(patient_id), "PAT-%03d", sensor / 4); // a few sensors per patient
+
+    if (opt->legacy) {
+        mesh_message_t msg = {0};
+        strcpy(msg.sensor_id, sensor_id);
+        strcpy(msg.patient_id, patient_id);
+        snprintf(msg.sensor_data, sizeof(msg.sensor_data), "%" PRIu32, seq);
+        memcpy(frame, &msg, sizeof(msg));
+        return sizeof(msg);
+    }
+    neo_wire_writer_t writer;
+    size_t len = 0;
+    neo_wire_writer_init(&writer, frame, NEO_WIRE_MAX_FRAME);
+    writer.flags = alert ? NEO_WIRE_FLAG_CRITICAL : 0;
+    neo_wire_set_sequence(&writer, sensor_id, frame_seq);
+    for (int i = 0; i < count; i++) {
+        neo_value_t value = { .type = NEO_VALUE_INT, .i = (int32_t)(seq + i) };
+        neo_wire_add(&writer, sensor_id, patient_id, &value);
+    }
+    neo_wire_finish(&writer, &len);
+    return len;
+}
+
+// Plays the root's mesh receive loop: frames arrive on one task and are ingested in order
+static uint64_t generate(const bench_options_t *opt, uint32_t *produced, uint32_t *rejected, uint32_t *redelivered)
+{
+    static uint8_t frame[NEO_WIRE_MAX_FRAME];
+    int64_t period_us = (int64_t)(opt->per_frame * 1e6 / opt->rate);
+    int64_t start = esp_timer_get_time();
+    int64_t end = start + opt->duration_s * 1000000LL;
+    int64_t handoff_at = opt->handoff_at_s > 0 ? start + opt->handoff_at_s * 1000000LL : INT64_MAX;
+    int64_t warmup_end = start + BENCH_WARMUP_US;
+    bool warm = false;
+    uint32_t warm_produced = 0;
+    int64_t *next_us = calloc(opt->sensors, sizeof(int64_t));
+    uint32_t *frame_seq = calloc(opt->sensors, sizeof(uint32_t));
+    uint64_t mesh_bytes = 0;
+    uint32_t seq = 1;
+    uint32_t frames = 0;
+    int stretch = 1; //the root's latest flow control hint, broadcast to every sensor
+    const flow_config_t flow_config = {
+        .high_pct = 75,
+        .low_pct = 25,
+        .max_stretch = 8,
+        .step_ms = 200,
+        .ttl_s = 60,
+    };
+    ESP_ERROR_CHECK(flow_init(&flow_config));
+
+    // Spread the sensors over one period so frames do not arrive in bursts
+    for (int s = 0; s < opt->sensors; s++) {
+        next_us[s] = start + period_us * s / opt->sensors;
+    }
+    while (true) {
+        int64_t now = esp_timer_get_time();
+        int64_t earliest = end;
+        if (!warm && now >= warmup_end) {
+            warm = true;
+            warmup_allocs = port_allocations();
+            warm_produced = *produced;
+        }
+        if (now >= handoff_at) {
+            handoff();
+            handoff_at = INT64_MAX;
+            now = esp_timer_get_time();
+        }
+        if (opt->flow) {
+            msg_queue_stats_t queue;
+            neo_wire_hint_t hint;
+            root_get_queue_stats(UPLOAD_LANE_ROUTINE, &queue);
+            if (flow_update(0, 0, queue.depth, queue.capacity, now, &hint)) {
+                stretch = hint.stretch;
+                stretch_max = stretch > stretch_max ? stretch : stretch_max;
+            }
+        }
+        for (int s = 0; s < opt->sensors; s++) {
+            // A stretched sensor sends the same readings in fewer, fuller frames
+            int count = opt->per_frame * stretch;
+            count = count > NEO_WIRE_MAX_READINGS ? NEO_WIRE_MAX_READINGS : count;
+            if (next_us[s] <= now && next_us[s] < end && seq + count < max_readings) {
+                bool alert = opt->critical_every > 0 && ++frames % opt->critical_every == 0;
+                size_t len = encode_frame(opt, s, frame_seq[s]++, seq, count, alert, frame);
+                root_ingest_result_t result;
+                pthread_mutex_lock(&results_lock);
+                int64_t injected = esp_timer_get_time();
+                for (int i = 0; i < count; i++) {
+                    sent_us[seq + i] = injected;
+                    critical[seq + i] = alert;
+                }
+                pthread_mutex_unlock(&results_lock);
+                // This thread plays the mesh receive task: only what the root does is counted
+                port_count_allocations(true);
+                root_ingest(frame, len, &result);
+                port_count_allocations(false);
+                frames_sent++;
+                *produced += count;
+                *rejected += count - result.queued;
+                if (opt->duplicate_rate > 0 && rand() < opt->duplicate_rate * ((double)RAND_MAX + 1)) {
+                    // A mesh retransmission: the same frame again, which the root must not upload twice
+                    port_count_allocations(true);
+                    root_ingest(frame, len, &result);
+                    port_count_allocations(false);
+                    (*redelivered)++;
+                    mesh_bytes += len;
+                }
+                seq += count;
+                mesh_bytes += len;
+                next_us[s] += period_us * count / opt->per_frame;
+            }
+            if (next_us[s] < earliest) {
+                earliest = next_us[s];
+            }
+        }
+        if (earliest >= end) {
+            break;
+        }
+        int64_t wait = earliest - esp_timer_get_time();
+        if (wait > 0) {
+            usleep(wait);
+        }
+    }
+    if (warm) {
+        steady_allocs = port_allocations() - warmup_allocs;
+        steady_readings = *produced - warm_produced;
+    } else {
+        warmup_allocs = port_allocations();
+    }
+    free(next_us);
+    free(frame_seq);
+    return mesh_bytes;
+}
+
+static int compare_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_latency(const char *label, int64_t *latencies, uint32_t n)
+{
+    if (n == 0) {
+        return;
+    }
+    qsort(latencies, n, sizeof(int64_t), compare_i64);
+    printf("%-12sp50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms (%" PRIu32 " readings)\n", label,
+           latencies[n / 2] / 1e3, latencies[(uint64_t)n * 90 / 100] / 1e3,
+           latencies[(uint64_t)n * 99 / 100] / 1e3, latencies[n - 1] / 1e3, n);
+}
+
+int main(int argc, char **argv)
+{
+    bench_options_t opt = {
+        .sensors = 20,
+        .rate = 5,
+        .duration_s = 10,
+        .per_frame = 1,
+        .tasks = 2,
+        .pool = 3,
+        .batch_items = BATCH_MAX_ITEMS,
+        .batch_delay_ms = 50,
+        .compress_min = 512,
+        .server = {
+            .path = "/patients",
+            .bulk_path = "/patients/bulk",
+            .bulk = true,
+            .latency_ms = 20,
+            .on_reading = on_reading,
+        },
+    };
+    if (parse_options(argc, argv, &opt) != 0) {
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN); // lwIP reports a closed peer through errno only
+
+    max_readings = (uint32_t)(opt.sensors * opt.rate * opt.duration_s * 1.1) + 64;
+    sent_us = calloc(max_readings, sizeof(int64_t));
+    arrived_us = calloc(max_readings, sizeof(int64_t));
+    critical = calloc(max_readings, sizeof(bool));
+    if (sent_us == NULL || arrived_us == NULL || critical == NULL) {
+        return 1;
+    }
+
+    uint16_t port = 0;
+    if (fake_server_start(&opt.server, &port) != 0) {
+        perror("fake server");
+        return 1;
+    }
+    static char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%u", port);
+
+    const root_config_t config = {
+        .host = "127.0.0.1",
+        .port = port_str,
+        .dns_ttl_ms = 300000,
+        .pool_size = opt.pool,
+        .persist_patients = false,
+        .upload = {
+            .path = opt.server.path,
+            .bulk_path = opt.batch_items > 0 ? opt.server.bulk_path : NULL,
+            .tasks = opt.tasks,
+            .pin_cores = false,
+            .batch_items = opt.batch_items > 0 ? opt.batch_items : 1,
+            .batch_bytes = BATCH_MAX_BYTES,
+            .batch_delay_ms = opt.batch_delay_ms,
+            .store_and_forward = opt.spool,
+            .encoding = opt.encoding,
+            .compress_min = opt.compress_min,
+        },
+    };
+    root_config = &config;
+    ESP_ERROR_CHECK(trace_start());
+    ESP_ERROR_CHECK(root_start(&config));
+
+    uint32_t produced = 0, rejected = 0, redelivered = 0;
+    struct timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+    int64_t start = esp_timer_get_time();
+    uint64_t mesh_bytes = generate(&opt, &produced, &rejected, &redelivered);
+
+    // Drain: wait until everything accepted has arrived, or nothing moved for longer than the
+    // uploader backs off after a failure
+    uint32_t last_delivered = 0;
+    int64_t last_progress = esp_timer_get_time();
+    while (esp_timer_get_time() - last_progress < (UPLOADER_RETRY_MS + 5000) * 1000LL) {
+        pthread_mutex_lock(&results_lock);
+        uint32_t now_delivered = delivered;
+        pthread_mutex_unlock(&results_lock);
+        if (now_delivered >= produced - rejected) {
+            break;
+        }
+        if (now_delivered != last_delivered) {
+            last_delivered = now_delivered;
+            last_progress = esp_timer_get_time();
+        }
+        usleep(10000);
+    }
+
+    pthread_mutex_lock(&results_lock);
+    int64_t *latencies = malloc((delivered + 1) * sizeof(int64_t));
+    int64_t *lanes[UPLOAD_LANES];
+    uint32_t lane_n[UPLOAD_LANES] = {0};
+    uint32_t n = 0;
+    for (int lane = 0; lane < UPLOAD_LANES; lane++) {
+        lanes[lane] = malloc((delivered + 1) * sizeof(int64_t));
+    }
+    for (uint32_t seq = 0; seq < max_readings; seq++) {
+        if (arrived_us[seq] != 0) {
+            int lane = critical[seq] ? UPLOAD_LANE_CRITICAL : UPLOAD_LANE_ROUTINE;
+            latencies[n++] = arrived_us[seq] - sent_us[seq];
+            lanes[lane][lane_n[lane]++] = arrived_us[seq] - sent_us[seq];
+        }
+    }
+    int64_t finished = last_arrival_us > start ? last_arrival_us : esp_timer_get_time();
+    uint32_t dups = duplicates;
+    pthread_mutex_unlock(&results_lock);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+    double cpu_us = (cpu_end.tv_sec - cpu_start.tv_sec) * 1e6 + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e3;
+
+    fake_server_stats_t server;
+    http_pool_stats_t pool;
+    msg_queue_stats_t queue, critical_queue;
+    uploader_stats_t upload;
+    fake_server_get_stats(&server);
+    http_pool_get_stats(&pool);
+    root_get_queue_stats(UPLOAD_LANE_ROUTINE, &queue);
+    root_get_queue_stats(UPLOAD_LANE_CRITICAL, &critical_queue);
+    uploader_get_stats(&upload);
+
+    double elapsed_s = (finished - start) / 1e6;
+    printf("load        %d sensors x %.1f/s for %d s, %d per frame, %s frames",
+           opt.sensors, opt.rate, opt.duration_s, opt.per_frame, opt.legacy ? "legacy" : "neo_wire");
+    if (opt.critical_every > 0) {
+        printf(", every %d critical", opt.critical_every);
+    }
+    printf("\n");
+    printf("server      %" PRIu32 " ms latency (+%" PRIu32 " jitter), %.2f errors, bulk %s\n",
+           opt.server.latency_ms, opt.server.jitter_ms, opt.server.error_rate, opt.server.bulk ? "on" : "off");
+    printf("readings    %" PRIu32 " produced, %" PRIu32 " delivered, %" PRIu32 " dropped at ingest, "
+           "%" PRIu32 " lost, %" PRIu32 " duplicates\n",
+           produced, n, rejected, produced - rejected - n, dups);
+    printf("throughput  %.1f readings/s\n", n / elapsed_s);
+    print_latency("latency", latencies, n);
+    if (lane_n[UPLOAD_LANE_CRITICAL] > 0) {
+        print_latency("  critical", lanes[UPLOAD_LANE_CRITICAL], lane_n[UPLOAD_LANE_CRITICAL]);
+        print_latency("  routine", lanes[UPLOAD_LANE_ROUTINE], lane_n[UPLOAD_LANE_ROUTINE]);
+    }
+    printf("bytes       %.1f mesh/reading, %.1f http/reading\n",
+           produced ? (double)mesh_bytes / produced : 0.0,
+           n ? (double)(server.bytes_in + server.bytes_out) / n : 0.0);
+    metric_histogram_t deflate_time;
+    metrics_get_histogram(METRIC_DEFLATE, &deflate_time);
+    printf("cpu         %.1f us/reading in the whole process (server included), %.2f us/reading compressing\n",
+           n ? cpu_us / n : 0.0, n ? (double)deflate_time.sum_us / n : 0.0);
+    if (opt.encoding != DEFLATE_NONE) {
+        printf("compress    %" PRIu32 " bodies %s, %" PRIu32 " -> %" PRIu32 " bytes (%.2fx), %" PRIu32
+               " incompressible, %" PRIu64 " inflated by the server\n",
+               upload.deflated, deflate_content_encoding(opt.encoding), upload.deflate_in, upload.deflate_out,
+               upload.deflate_out ? (double)upload.deflate_in / upload.deflate_out : 0.0, upload.incompressible,
+               server.compressed);
+    }
+    printf("http        %" PRIu64 " requests, %" PRIu64 " connections, %" PRIu32 " reused, %" PRIu64 " errors injected\n",
+           server.requests, server.connections, pool.reused, server.errors);
+    printf("upload      %" PRIu32 " batches, largest %" PRIu32 ", %" PRIu32 " upserts (%" PRIu32 " alerts), "
+           "%" PRIu32 " spooled, %" PRIu32 " replayed, %" PRIu32 " failed\n",
+           upload.batches, upload.largest_batch, upload.upserts, upload.alerts, upload.spooled, upload.replayed,
+           upload.failed);
+    printf("queue       high water %" PRIu32 "/%d, %" PRIu32 " dropped; critical %" PRIu32 "/%d, %" PRIu32 " dropped\n",
+           queue.high_water, ROOT_QUEUE_LEN, queue.dropped,
+           critical_queue.high_water, ROOT_CRITICAL_QUEUE_LEN, critical_queue.dropped);
+    if (opt.flow) {
+        flow_stats_t flow;
+        flow_get_stats(&flow);
+        printf("flow        %" PRIu32 " frames, %" PRIu32 " hints, %" PRIu32 " slowdowns, %" PRIu32
+               " recoveries, stretch up to x%d, queue peak %d%%\n",
+               frames_sent, flow.hints, flow.slowdowns, flow.recoveries, stretch_max, flow.peak_pct);
+    }
+    if (opt.duplicate_rate > 0) {
+        dedup_stats_t dedup;
+        dedup_get_stats(&dedup);
+        printf("dedup       %" PRIu32 " frames delivered twice, %" PRIu32 " dropped as duplicates, %" PRIu32
+               " window restarts, %" PRIu32 " evictions\n",
+               redelivered, dedup.duplicates, dedup.restarts, dedup.evictions);
+    }
+    if (opt.handoff_at_s > 0) {
+        printf("handoff     %" PRIu32 " queued + %" PRIu32 " spooled readings and %" PRIu32 " patients in %" PRIu32
+               " frames, %" PRIu32 " kept, %" PRIu32 " lost, %.1f ms\n",
+               handoff_stats.readings, handoff_stats.spooled, handoff_stats.patients, handoff_frames,
+               handoff_stats.kept, handoff_stats.lost, handoff_us / 1e3);
+    }
+    trace_stats_t trace;
+    trace_get_stats(&trace);
+    printf("trace       %" PRIu32 " records, %" PRIu32 " formatted, %" PRIu32 " dropped\n",
+           trace.recorded, trace.formatted, trace.dropped);
+    printf("allocs      %" PRIu64 " during the warm-up, %" PRIu64 " in steady state over %" PRIu32 " readings\n",
+           warmup_allocs, steady_allocs, steady_readings);
+    char metrics_line[768];
+    metrics_format(metrics_line, sizeof(metrics_line));
+    printf("metrics     %s\n", metrics_line);
+    free(latencies);
+    for (int lane = 0; lane < UPLOAD_LANES; lane++) {
+        free(lanes[lane]);
+    }
+    if (opt.check_allocs && (steady_allocs > 0 || steady_readings == 0)) {
+        fprintf(stderr, "allocation check failed: %" PRIu64 " heap allocations in steady state over %" PRIu32
+                " readings\n", steady_allocs, steady_readings);
+        return 3;
+    }
+    return 0;
+}
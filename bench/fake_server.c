@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <zlib.h>
+#include "fake_server.h"
+
+#define SERVER_BUF_SIZE 16384
+#define SERVER_MAX_PATIENTS 1024
+#define SERVER_ID_LEN 32
+
+static fake_server_config_t server_config;
+static int listen_sock = -1;
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+static char patients[SERVER_MAX_PATIENTS][SERVER_ID_LEN];
+static int patient_count = 0;
+static fake_server_stats_t stats = {0};
+
+static int find_patient(const char *id, size_t len)
+{
+    for (int i = 0; i < patient_count; i++) {
+        if (strlen(patients[i]) == len && memcmp(patients[i], id, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool patient_known(const char *id, size_t len)
+{
+    pthread_mutex_lock(&server_lock);
+    bool known = find_patient(id, len) >= 0;
+    pthread_mutex_unlock(&server_lock);
+    return known;
+}
+
+// Create every patient named in `body` and report every reading it carries
+static void store_readings(const char *body, size_t len)
+{
+    static const char patient_key[] = "\"patient_id\":\"";
+    static const char data_key[] = "\"sensor_data\":\"";
+    const char *end = body + len;
+
+    for (const char *p = body; p < end; p++) {
+        if ((size_t)(end - p) > sizeof(patient_key) && memcmp(p, patient_key, sizeof(patient_key) - 1) == 0) {
+            const char *id = p + sizeof(patient_key) - 1;
+            const char *quote = memchr(id, '"', end - id);
+            size_t id_len = quote ? (size_t)(quote - id) : 0;
+            pthread_mutex_lock(&server_lock);
+            if (id_len > 0 && id_len < SERVER_ID_LEN && find_patient(id, id_len) < 0 &&
+                    patient_count < SERVER_MAX_PATIENTS) {
+                memcpy(patients[patient_count], id, id_len);
+                patients[patient_count++][id_len] = '\0';
+            }
+            pthread_mutex_unlock(&server_lock);
+        } else if ((size_t)(end - p) > sizeof(data_key) && memcmp(p, data_key, sizeof(data_key) - 1) == 0) {
+            server_config.on_reading((uint32_t)strtoul(p + sizeof(data_key) - 1, NULL, 10));
+        }
+    }
+}
+
+static int handle_request(const char *method, const char *target, const char *body, size_t body_len)
+{
+    size_t path_len = strlen(server_config.path);
+    bool patient_path = strncmp(target, server_config.path, path_len) == 0 && target[path_len] == '/';
+    const char *id = target + path_len + 1;
+
+    if (server_config.error_rate > 0 && drand48() < server_config.error_rate) {
+        pthread_mutex_lock(&server_lock);
+        stats.errors++;
+        pthread_mutex_unlock(&server_lock);
+        return 503;
+    }
+    if (strcmp(method, "POST") == 0 && server_config.bulk_path && strcmp(target, server_config.bulk_path) == 0) {
+        if (!server_config.bulk) {
+            return 404;
+        }
+        store_readings(body, body_len);
+        return 200;
+    }
+    if (strcmp(method, "POST") == 0 && strcmp(target, server_config.path) == 0) {
+        store_readings(body, body_len);
+        return 201;
+    }
+    if (strcmp(method, "GET") == 0 && patient_path) {
+        return patient_known(id, strlen(id)) ? 200 : 404;
+    }
+    if (strcmp(method, "PATCH") == 0 && patient_path) {
+        if (!patient_known(id, strlen(id))) {
+            return 404;
+        }
+        store_readings(body, body_len);
+        return 200;
+    }
+    return 404;
+}
+
+/* Inflate a gzip or zlib body into `out`. Returns its length, -1 if it is not valid. */
+static long inflate_body(const char *body, size_t len, char *out, size_t size)
+{
+    z_stream z = {0};
+    if (inflateInit2(&z, 15 + 32) != Z_OK) { // either wrapper, told apart by the header
+        return -1;
+    }
+    z.next_in = (Bytef *)body;
+    z.avail_in = len;
+    z.next_out = (Bytef *)out;
+    z.avail_out = size;
+    int ret = inflate(&z, Z_FINISH);
+    long inflated = ret == Z_STREAM_END && z.avail_in == 0 ? (long)z.total_out : -1;
+    inflateEnd(&z);
+    return inflated;
+}
+
+static const char *reason_phrase(int status)
+{
+    switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 415: return "Unsupported Media Type";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+static void *connection_thread(void *arg)
+{
+    int sock = (int)(intptr_t)arg;
+    char *buf = malloc(SERVER_BUF_SIZE + 1);
+    char *inflated = malloc(SERVER_BUF_SIZE * 4);
+    size_t have = 0;
+    uint32_t served = 0;
+    unsigned short seed[3] = { (unsigned short)sock, 0x1234, 0x5678 };
+
+    while (buf != NULL) {
+        char *headers_end = NULL;
+        while ((headers_end = memmem(buf, have, "\r\n\r\n", 4)) == NULL) {
+            ssize_t n = have < SERVER_BUF_SIZE ? recv(sock, buf + have, SERVER_BUF_SIZE - have, 0) : -1;
+            if (n <= 0) {
+                goto done;
+            }
+            have += n;
+        }
+        *headers_end = '\0';
+        size_t header_len = headers_end - buf + 4;
+        long content_length = 0;
+        char *cl = strcasestr(buf, "\r\nContent-Length:");
+        if (cl != NULL) {
+            content_length = atol(cl + 17);
+        }
+        char encoding[16] = "";
+        char *ce = strcasestr(buf, "\r\nContent-Encoding:");
+        if (ce != NULL) {
+            sscanf(ce + 19, " %15[^\r]", encoding);
+        }
+        if (content_length < 0 || header_len + content_length > SERVER_BUF_SIZE) {
+            break;
+        }
+        while (have < header_len + content_length) {
+            ssize_t n = recv(sock, buf + have, SERVER_BUF_SIZE - have, 0);
+            if (n <= 0) {
+                goto done;
+            }
+            have += n;
+        }
+
+        char method[8] = "", target[128] = "";
+        sscanf(buf, "%7s %127s", method, target);
+        int status = 0;
+        if (encoding[0] == '\0') {
+            status = handle_request(method, target, buf + header_len, content_length);
+        } else if (server_config.identity_only || (strcmp(encoding, "gzip") != 0 && strcmp(encoding, "deflate") != 0)) {
+            status = 415;
+        } else {
+            long body_len = inflated ? inflate_body(buf + header_len, content_length, inflated, SERVER_BUF_SIZE * 4) : -1;
+            status = body_len < 0 ? 400 : handle_request(method, target, inflated, body_len);
+            pthread_mutex_lock(&server_lock);
+            stats.compressed++;
+            stats.inflated_bytes += body_len > 0 ? body_len : 0;
+            pthread_mutex_unlock(&server_lock);
+        }
+
+        uint32_t delay_ms = server_config.latency_ms;
+        if (server_config.jitter_ms > 0) {
+            delay_ms += nrand48(seed) % (server_config.jitter_ms + 1);
+        }
+        if (delay_ms > 0) {
+            usleep(delay_ms * 1000);
+        }
+
+        bool closing = server_config.close_every > 0 && ++served % server_config.close_every == 0;
+        char response[256];
+        const char *body = status < 300 ? "{\"ok\":true}" : "{\"ok\":false}";
+        int len = 0;
+        if (server_config.chunked) {
+            len = snprintf(response, sizeof(response),
+                           "HTTP/1.1 %d %s\r\n"
+                           "Content-Type: application/json\r\n"
+                           "Transfer-Encoding: chunked\r\n"
+                           "%s\r\n"
+                           "4\r\n%.4s\r\n%x\r\n%s\r\n0\r\n\r\n",
+                           status, reason_phrase(status), closing ? "Connection: close\r\n" : "",
+                           body, (unsigned)strlen(body) - 4, body + 4);
+        } else {
+            len = snprintf(response, sizeof(response),
+                           "HTTP/1.1 %d %s\r\n"
+                           "Content-Type: application/json\r\n"
+                           "Content-Length: %d\r\n"
+                           "%s\r\n"
+                           "%s",
+                           status, reason_phrase(status), (int)strlen(body),
+                           closing ? "Connection: close\r\n" : "", body);
+        }
+        // Chunked responses go out in small pieces so the client sees them split
+        int piece = server_config.chunked ? 16 : len;
+        int sent = 0;
+        while (sent < len) {
+            int n = len - sent < piece ? len - sent : piece;
+            if (send(sock, response + sent, n, MSG_NOSIGNAL) != n) {
+                break;
+            }
+            sent += n;
+        }
+        if (sent != len) {
+            break;
+        }
+
+        pthread_mutex_lock(&server_lock);
+        stats.requests++;
+        stats.bytes_in += header_len + content_length;
+        stats.bytes_out += len;
+        pthread_mutex_unlock(&server_lock);
+
+        // Keep whatever the client pipelined behind this request
+        size_t used = header_len + content_length;
+        memmove(buf, buf + used, have - used);
+        have -= used;
+        if (closing) {
+            break;
+        }
+    }
+done:
+    free(buf);
+    free(inflated);
+    close(sock);
+    return NULL;
+}
+
+static void *accept_thread(void *arg)
+{
+    while (true) {
+        int sock = accept(listen_sock, NULL, NULL);
+        if (sock < 0) {
+            if (errno == EINTR) continue;
+            return NULL;
+        }
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pthread_mutex_lock(&server_lock);
+        stats.connections++;
+        pthread_mutex_unlock(&server_lock);
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, connection_thread, (void *)(intptr_t)sock) != 0) {
+            close(sock);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+int fake_server_start(const fake_server_config_t *config, uint16_t *port)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        .sin_port = 0,
+    };
+    socklen_t addr_len = sizeof(addr);
+    pthread_t thread;
+
+    server_config = *config;
+    srand48(1); // reproducible error injection
+    listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_sock < 0 ||
+            bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(listen_sock, 16) != 0 ||
+            getsockname(listen_sock, (struct sockaddr *)&addr, &addr_len) != 0 ||
+            pthread_create(&thread, NULL, accept_thread, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    *port = ntohs(addr.sin_port);
+    return 0;
+}
+
+void fake_server_get_stats(fake_server_stats_t *out)
+{
+    pthread_mutex_lock(&server_lock);
+    *out = stats;
+    pthread_mutex_unlock(&server_lock);
+}
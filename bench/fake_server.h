@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Minimal HTTP/1.1 keep-alive server standing in for the patient API:
+ *   GET   <path>/<id>  200 if the patient was created, 404 otherwise
+ *   POST  <path>       create the patient and store the reading, 201
+ *   PATCH <path>/<id>  store the reading, 404 for unknown patients
+ *   POST  <bulk path>  JSON array of readings, 200 (404 when bulk is disabled)
+ * Bodies sent with Content-Encoding gzip or deflate are inflated first, 415 for anything else.
+ * Every stored reading is reported through `on_reading` with the number in its sensor_data. */
+typedef struct {
+    const char *path;
+    const char *bulk_path;
+    bool bulk; //accept bulk uploads
+    uint32_t latency_ms; //added before every response
+    uint32_t jitter_ms; //uniformly random extra latency
+    double error_rate; //fraction of requests answered with 503
+    uint32_t close_every; //close the connection after this many responses, 0 to keep it open
+    bool chunked; //send chunked bodies, split over several TCP segments
+    bool identity_only; //answer compressed bodies with 415 instead of inflating them
+    void (*on_reading)(uint32_t seq);
+} fake_server_config_t;
+
+typedef struct {
+    uint64_t connections;
+    uint64_t requests;
+    uint64_t errors; //injected 503s
+    uint64_t bytes_in; //request bytes received, headers included
+    uint64_t compressed; //requests with a gzip or deflate body
+    uint64_t inflated_bytes; //their bodies once inflated
+    uint64_t bytes_out;
+} fake_server_stats_t;
+
+/* Listen on 127.0.0.1 with an ephemeral port written to `port`. */
+int fake_server_start(const fake_server_config_t *config, uint16_t *port);
+
+void fake_server_get_stats(fake_server_stats_t *stats);
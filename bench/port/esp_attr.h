@@ -0,0 +1,4 @@
+#pragma once
+
+// No RTC memory on the host, the topology ring is ordinary zeroed memory
+#define RTC_NOINIT_ATTR
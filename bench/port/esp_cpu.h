@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Emulates a 240 MHz cycle counter from the monotonic clock. */
+uint32_t esp_cpu_get_cycle_count(void);
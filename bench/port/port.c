@@ -0,0 +1,492 @@
+#include <errno.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "port.h"
+
+esp_log_level_t port_log_level = ESP_LOG_WARN;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    port_log_level = level; // per-tag levels are not needed on the host
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+void port_abort(const char *file, int line, const char *expr, esp_err_t err)
+{
+    fprintf(stderr, "%s:%d: %s failed: %s\n", file, line, expr, esp_err_to_name(err));
+    abort();
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#define PORT_CPU_MHZ 240
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec) * PORT_CPU_MHZ / 1000);
+}
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void)
+{
+    return PORT_CPU_MHZ;
+}
+
+// Absolute CLOCK_MONOTONIC deadline for a wait of `ticks` milliseconds
+static struct timespec port_deadline(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ticks / 1000;
+    ts.tv_nsec += (long)(ticks % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+static void port_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Wait on `cond` until `ready` is non-zero or the ticks run out. Called with `mutex` held.
+static bool port_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const uint32_t *ready, TickType_t ticks)
+{
+    struct timespec deadline = port_deadline(ticks);
+    while (*ready == 0) {
+        if (ticks == 0) {
+            return false;
+        }
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(cond, mutex);
+        } else if (pthread_cond_timedwait(cond, mutex, &deadline) == ETIMEDOUT) {
+            return *ready != 0;
+        }
+    }
+    return true;
+}
+
+/* Semaphores */
+
+struct port_sem {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t count;
+    uint32_t max;
+};
+
+static SemaphoreHandle_t port_sem_create(uint32_t max, uint32_t initial)
+{
+    struct port_sem *sem = calloc(1, sizeof(*sem));
+    if (sem == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&sem->lock, NULL);
+    port_cond_init(&sem->cond);
+    sem->count = initial;
+    sem->max = max;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return port_sem_create(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return port_sem_create(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    return port_sem_create(max_count, initial_count);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait)
+{
+    pthread_mutex_lock(&sem->lock);
+    bool taken = port_wait(&sem->cond, &sem->lock, &sem->count, wait);
+    if (taken) {
+        sem->count--;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    BaseType_t given = pdFALSE;
+    pthread_mutex_lock(&sem->lock);
+    if (sem->count < sem->max) {
+        sem->count++;
+        given = pdTRUE;
+        pthread_cond_signal(&sem->cond);
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return given;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    UBaseType_t count = sem->count;
+    pthread_mutex_unlock(&sem->lock);
+    return count;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_mutex_destroy(&sem->lock);
+    pthread_cond_destroy(&sem->cond);
+    free(sem);
+}
+
+/* Tasks */
+
+struct port_task {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+    TaskFunction_t fn;
+    void *arg;
+    char name[16]; //configMAX_TASK_NAME_LEN
+    uint32_t stack_bytes;
+};
+
+static __thread struct port_task *current_task = NULL;
+static __thread bool counting_allocations = false;
+
+static void *port_task_entry(void *arg)
+{
+    struct port_task *task = arg;
+    current_task = task;
+    counting_allocations = true;
+    task->fn(task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    struct port_task *task = calloc(1, sizeof(*task));
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    pthread_mutex_init(&task->lock, NULL);
+    port_cond_init(&task->cond);
+    task->fn = fn;
+    task->arg = arg;
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    task->stack_bytes = stack_depth;
+    if (handle != NULL) {
+        *handle = task; // set before the task runs, as FreeRTOS does
+    }
+    if (pthread_create(&task->thread, NULL, port_task_entry, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == current_task) {
+        pthread_exit(NULL);
+    }
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = { .tv_sec = ticks / 1000, .tv_nsec = (long)(ticks % 1000) * 1000000 };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current_task;
+}
+
+char *pcTaskGetName(TaskHandle_t task)
+{
+    task = task != NULL ? task : current_task;
+    return task != NULL ? task->name : "main";
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    task = task != NULL ? task : current_task;
+    return task != NULL ? task->stack_bytes : 0; // host stacks are not watched, report them untouched
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t wait)
+{
+    struct port_task *task = current_task;
+    pthread_mutex_lock(&task->lock);
+    port_wait(&task->cond, &task->lock, &task->notify, wait);
+    uint32_t value = task->notify;
+    if (value > 0) {
+        task->notify = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+/* Heap. The host heap has no size of its own: a PORT_HEAP_SIZE heap is reported, less what the
+ * whole process has in use. */
+
+static uint32_t heap_low_water = PORT_HEAP_SIZE;
+
+uint32_t esp_get_free_heap_size(void)
+{
+    size_t used = mallinfo2().uordblks;
+    uint32_t free_heap = used < PORT_HEAP_SIZE ? PORT_HEAP_SIZE - used : 0;
+    heap_low_water = free_heap < heap_low_water ? free_heap : heap_low_water;
+    return free_heap;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    esp_get_free_heap_size();
+    return heap_low_water;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return esp_get_free_heap_size();
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return esp_get_free_heap_size();
+}
+
+/* Allocation counting. malloc and friends are replaced for the whole process, glibc included,
+ * and count calls made by FreeRTOS tasks and threads that asked for it. */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+static atomic_uint_fast64_t allocations = 0;
+
+void *malloc(size_t size)
+{
+    if (counting_allocations) {
+        atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    if (counting_allocations) {
+        atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    }
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (counting_allocations) {
+        atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void port_count_allocations(bool counted)
+{
+    counting_allocations = counted;
+}
+
+uint64_t port_allocations(void)
+{
+    return atomic_load(&allocations);
+}
+
+/* Flash partition */
+
+static uint8_t flash[PORT_PARTITION_SIZE];
+static bool flash_erased = false;
+static const esp_partition_t spool_partition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .address = 0x150000,
+    .size = PORT_PARTITION_SIZE,
+    .label = "spool",
+};
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    if (label != NULL && strcmp(label, spool_partition.label) != 0) {
+        return NULL;
+    }
+    if (!flash_erased) {
+        memset(flash, 0xff, sizeof(flash)); // a fresh chip reads as erased
+        flash_erased = true;
+    }
+    return &spool_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, flash + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    if (dst_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const uint8_t *bytes = src;
+    for (size_t i = 0; i < size; i++) {
+        flash[dst_offset + i] &= bytes[i]; // programming only clears bits
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (offset + size > partition->size || offset % 4096 != 0 || size % 4096 != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(flash + offset, 0xff, size);
+    return ESP_OK;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+/* NVS */
+
+static uint8_t nvs_blob[4096];
+static size_t nvs_blob_len = 0;
+static char nvs_key[16] = "";
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (open_mode == NVS_READONLY && nvs_blob_len == 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    if (nvs_blob_len == 0 || strcmp(key, nvs_key) != 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value != NULL) {
+        if (*length < nvs_blob_len) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(out_value, nvs_blob, nvs_blob_len);
+    }
+    *length = nvs_blob_len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    if (length > sizeof(nvs_blob)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(nvs_blob, value, length);
+    nvs_blob_len = length;
+    snprintf(nvs_key, sizeof(nvs_key), "%s", key);
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
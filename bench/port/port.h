@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Host-only hooks for the bench, with no ESP-IDF counterpart. */
+#define PORT_HEAP_SIZE (320 * 1024) //heap the ESP-IDF heap functions report, about an ESP32-S3's internal RAM
+
+/* Count heap allocations made by the calling thread. FreeRTOS tasks are always counted. */
+void port_count_allocations(bool counted);
+
+/* Allocations counted so far, across every thread. */
+uint64_t port_allocations(void);
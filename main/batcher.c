@@ -0,0 +1,126 @@
+#include <string.h>
+#include "batcher.h"
+
+// Append `len` bytes at out[*pos]. Returns false if they do not fit.
+static bool batch_put(char *out, size_t size, size_t *pos, const char *data, size_t len)
+{
+    if (len > size - *pos) {
+        return false;
+    }
+    memcpy(out + *pos, data, len);
+    *pos += len;
+    return true;
+}
+
+// Append a quoted JSON string read from a field of at most `max` bytes
+static bool batch_put_string(char *out, size_t size, size_t *pos, const char *str, size_t max)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t len = strnlen(str, max);
+    size_t run = 0; // characters that need no escaping are copied in runs
+
+    if (!batch_put(out, size, pos, "\"", 1)) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)str[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            run++;
+            continue;
+        }
+        char escaped[6] = { '\\', (char)c };
+        size_t escaped_len = 2;
+        if (c == '\n') {
+            escaped[1] = 'n';
+        } else if (c == '\r') {
+            escaped[1] = 'r';
+        } else if (c == '\t') {
+            escaped[1] = 't';
+        } else if (c < 0x20) {
+            memcpy(escaped + 1, "u00", 3);
+            escaped[4] = hex[c >> 4];
+            escaped[5] = hex[c & 15];
+            escaped_len = 6;
+        }
+        if (!batch_put(out, size, pos, str + i - run, run) || !batch_put(out, size, pos, escaped, escaped_len)) {
+            return false;
+        }
+        run = 0;
+    }
+    return batch_put(out, size, pos, str + len - run, run) && batch_put(out, size, pos, "\"", 1);
+}
+
+esp_err_t batch_encode_reading(const mesh_message_t *msg, char *out, size_t size, size_t *len)
+{
+    size_t pos = 0;
+    bool ok = batch_put(out, size, &pos, "{\"patient_id\":", 14) &&
+              batch_put_string(out, size, &pos, msg->patient_id, sizeof(msg->patient_id)) &&
+              batch_put(out, size, &pos, ",\"sensor_id\":", 13) &&
+              batch_put_string(out, size, &pos, msg->sensor_id, sizeof(msg->sensor_id)) &&
+              batch_put(out, size, &pos, ",\"sensor_data\":", 15) &&
+              batch_put_string(out, size, &pos, msg->sensor_data, sizeof(msg->sensor_data)) &&
+              batch_put(out, size, &pos, "}", 1);
+    if (!ok) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *len = pos;
+    return ESP_OK;
+}
+
+void batch_init(batch_t *batch, size_t max_bytes)
+{
+    batch->max_bytes = max_bytes < BATCH_MAX_BYTES ? max_bytes : BATCH_MAX_BYTES;
+    batch_reset(batch);
+}
+
+void batch_reset(batch_t *batch)
+{
+    batch->count = 0;
+    batch->body[0] = '[';
+    batch->body_len = 1;
+    batch->first_us = 0;
+}
+
+bool batch_add(batch_t *batch, const mesh_message_t *msg, int64_t queued_us, int64_t now_us)
+{
+    if (batch->count >= BATCH_MAX_ITEMS) {
+        return false;
+    }
+    // Keep one byte for the closing bracket
+    size_t end = batch->max_bytes - 1;
+    size_t pos = batch->body_len;
+    size_t len = 0;
+    if ((batch->count > 0 && !batch_put(batch->body, end, &pos, ",", 1)) ||
+            batch_encode_reading(msg, batch->body + pos, end - pos, &len) != ESP_OK) {
+        return false;
+    }
+    if (batch->count == 0) {
+        batch->first_us = now_us;
+    }
+    batch->items[batch->count] = *msg;
+    batch->queued_us[batch->count++] = queued_us;
+    batch->body_len = pos + len;
+    return true;
+}
+
+size_t batch_finish(batch_t *batch)
+{
+    batch->body[batch->body_len] = ']';
+    return batch->body_len + 1;
+}
+
+const char *batch_flush_reason_str(batch_flush_reason_t reason)
+{
+    switch (reason) {
+    case BATCH_FLUSH_ITEMS:
+        return "items";
+    case BATCH_FLUSH_BYTES:
+        return "bytes";
+    case BATCH_FLUSH_TIMEOUT:
+        return "timeout";
+    case BATCH_FLUSH_REPLAY:
+        return "replay";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "neolink.h"
+
+#define BATCH_MAX_ITEMS 16 //upper bound for uploader_config_t.batch_items
+#define BATCH_MAX_BYTES 2048 //upper bound for uploader_config_t.batch_bytes
+// One reading as JSON when every character of its fields has to be escaped as \u00XX
+#define BATCH_READING_MAX (sizeof("{\"patient_id\":\"\",\"sensor_id\":\"\",\"sensor_data\":\"\"}") + \
+                           6 * (sizeof(((mesh_message_t *)0)->patient_id) + \
+                                sizeof(((mesh_message_t *)0)->sensor_id) + \
+                                sizeof(((mesh_message_t *)0)->sensor_data)))
+
+typedef enum {
+    BATCH_FLUSH_ITEMS, //item limit reached
+    BATCH_FLUSH_BYTES, //next reading would not fit in the byte limit
+    BATCH_FLUSH_TIMEOUT, //oldest reading waited the maximum delay
+    BATCH_FLUSH_REPLAY, //readings read back from the store-and-forward spool
+    BATCH_FLUSH_REASONS,
+} batch_flush_reason_t;
+
+/* Readings coalesced into one JSON array body. The readings themselves are kept so the batch
+ * can still be written one patient at a time when the bulk request is not accepted. */
+typedef struct {
+    mesh_message_t items[BATCH_MAX_ITEMS];
+    int64_t queued_us[BATCH_MAX_ITEMS]; //when each reading reached the root, 0 if unknown
+    size_t count;
+    char body[BATCH_MAX_BYTES];
+    size_t body_len; //length of the body without the closing bracket
+    size_t max_bytes;
+    int64_t first_us; //when the first reading was added
+} batch_t;
+
+/* Write a reading as a JSON object, with its strings escaped. Nothing is truncated: if it does not
+ * fit in `size` bytes ESP_ERR_INVALID_SIZE is returned. */
+esp_err_t batch_encode_reading(const mesh_message_t *msg, char *out, size_t size, size_t *len);
+
+void batch_init(batch_t *batch, size_t max_bytes);
+void batch_reset(batch_t *batch);
+
+/* Append a reading that reached the root at `queued_us`. Returns false, leaving the batch unchanged,
+ * if it does not fit. */
+bool batch_add(batch_t *batch, const mesh_message_t *msg, int64_t queued_us, int64_t now_us);
+
+/* Close the JSON array and return the body length. */
+size_t batch_finish(batch_t *batch);
+
+const char *batch_flush_reason_str(batch_flush_reason_t reason);
@@ -0,0 +1,137 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "budget.h"
+
+#define BUDGET_STACK 2560
+
+static const char *TAG = "neoBudget";
+static TaskHandle_t watched[BUDGET_MAX_TASKS];
+static bool alarmed[BUDGET_MAX_TASKS]; //warned about this task already
+static bool heap_low = false;
+static budget_stats_t stats = {0};
+static TaskHandle_t budget_task_handle = NULL;
+static portMUX_TYPE budget_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t budget_watch(TaskHandle_t task, uint32_t stack_bytes)
+{
+    esp_err_t err = ESP_ERR_NO_MEM;
+    if (task == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&budget_lock);
+    if (stats.tasks < BUDGET_MAX_TASKS) {
+        watched[stats.tasks] = task;
+        stats.task[stats.tasks] = (budget_task_t) {
+            .name = pcTaskGetName(task),
+            .stack_bytes = stack_bytes,
+            .stack_free = stack_bytes,
+        };
+        stats.tasks++;
+        err = ESP_OK;
+    }
+    portEXIT_CRITICAL(&budget_lock);
+    return err;
+}
+
+static void budget_sample(void)
+{
+    uint32_t free_heap = esp_get_free_heap_size();
+    uint32_t min_free_heap = esp_get_minimum_free_heap_size();
+    uint32_t largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    uint32_t stack_free[BUDGET_MAX_TASKS];
+
+    portENTER_CRITICAL(&budget_lock);
+    int tasks = stats.tasks;
+    portEXIT_CRITICAL(&budget_lock);
+    // Walking a stack for its high-water mark is too slow for a critical section
+    for (int i = 0; i < tasks; i++) {
+        stack_free[i] = uxTaskGetStackHighWaterMark(watched[i]); // bytes on ESP-IDF
+    }
+
+    portENTER_CRITICAL(&budget_lock);
+    stats.free_heap = free_heap;
+    stats.min_free_heap = min_free_heap;
+    stats.largest_block = largest_block;
+    for (int i = 0; i < tasks; i++) {
+        stats.task[i].stack_free = stack_free[i];
+    }
+    portEXIT_CRITICAL(&budget_lock);
+}
+
+// Warn once per task, and once each time the heap drops below its floor
+static void budget_check(void)
+{
+    budget_stats_t now;
+    budget_get_stats(&now);
+    for (int i = 0; i < now.tasks; i++) {
+        if (!alarmed[i] && now.task[i].stack_free < BUDGET_STACK_LOW_BYTES) {
+            alarmed[i] = true;
+            ESP_LOGW(TAG, "Task %s has %" PRIu32 " of %" PRIu32 " stack bytes left", now.task[i].name,
+                     now.task[i].stack_free, now.task[i].stack_bytes);
+            portENTER_CRITICAL(&budget_lock);
+            stats.stack_alarms++;
+            portEXIT_CRITICAL(&budget_lock);
+        }
+    }
+    if (!heap_low && now.free_heap < BUDGET_HEAP_LOW_BYTES) {
+        ESP_LOGW(TAG, "Free heap down to %" PRIu32 " bytes, largest block %" PRIu32, now.free_heap, now.largest_block);
+        portENTER_CRITICAL(&budget_lock);
+        stats.heap_alarms++;
+        portEXIT_CRITICAL(&budget_lock);
+    }
+    heap_low = now.free_heap < BUDGET_HEAP_LOW_BYTES;
+}
+
+static void budget_log(void)
+{
+    budget_stats_t now;
+    char line[256];
+    int len = 0;
+    budget_get_stats(&now);
+    for (int i = 0; i < now.tasks && len < (int)sizeof(line); i++) {
+        len += snprintf(line + len, sizeof(line) - len, "%s%s:%" PRIu32 "/%" PRIu32, i > 0 ? ", " : "",
+                        now.task[i].name, now.task[i].stack_bytes - now.task[i].stack_free, now.task[i].stack_bytes);
+    }
+    ESP_LOGI(TAG, "heap free:%" PRIu32 ", low-water:%" PRIu32 ", largest block:%" PRIu32 ", alarms stack/heap:%" PRIu32 "/%" PRIu32,
+             now.free_heap, now.min_free_heap, now.largest_block, now.stack_alarms, now.heap_alarms);
+    // most stack used/size in bytes
+    ESP_LOGI(TAG, "stacks: %s", now.tasks > 0 ? line : "none watched");
+}
+
+static void budget_task(void *arg)
+{
+    TickType_t last_log = xTaskGetTickCount();
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(BUDGET_CHECK_MS));
+        budget_check();
+        if (xTaskGetTickCount() - last_log >= pdMS_TO_TICKS(BUDGET_LOG_MS)) {
+            last_log = xTaskGetTickCount();
+            budget_log();
+        }
+    }
+}
+
+esp_err_t budget_start(void)
+{
+    if (budget_task_handle != NULL) {
+        return ESP_OK;
+    }
+    if (xTaskCreate(budget_task, "neoBudget", BUDGET_STACK, NULL, 1, &budget_task_handle) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    budget_watch(budget_task_handle, BUDGET_STACK);
+    budget_sample();
+    budget_log();
+    return ESP_OK;
+}
+
+void budget_get_stats(budget_stats_t *out)
+{
+    budget_sample();
+    portENTER_CRITICAL(&budget_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&budget_lock);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+/* Memory budget watch. The root data path runs from arenas sized at startup (queue slots, batches,
+ * request heads, spool and deflate buffers are all static, sockets come from a fixed pool), so once
+ * running neither the heap nor the stacks should move. A low-priority task samples the free heap,
+ * its low-water mark and the largest free block, which shows fragmentation, and the stack
+ * high-water mark of every watched task. It warns once when a stack or the heap runs low and logs
+ * the whole budget every BUDGET_LOG_MS. */
+#define BUDGET_MAX_TASKS 12 //tasks that can be watched
+#define BUDGET_CHECK_MS 5000 //how often stacks and the heap are sampled
+#define BUDGET_LOG_MS 60000 //how often the budget is logged
+#define BUDGET_STACK_LOW_BYTES 512 //warn when a watched task has come this close to its stack end
+#define BUDGET_HEAP_LOW_BYTES (24 * 1024) //warn when the free heap falls below this
+
+typedef struct {
+    const char *name;
+    uint32_t stack_bytes; //stack size the task was created with
+    uint32_t stack_free; //least stack it has had left
+} budget_task_t;
+
+typedef struct {
+    uint32_t free_heap;
+    uint32_t min_free_heap; //lowest since boot
+    uint32_t largest_block; //largest allocation that could succeed now
+    uint32_t stack_alarms; //tasks that went below BUDGET_STACK_LOW_BYTES
+    uint32_t heap_alarms; //times the free heap went below BUDGET_HEAP_LOW_BYTES
+    int tasks;
+    budget_task_t task[BUDGET_MAX_TASKS];
+} budget_stats_t;
+
+/* Start the sampling task. Calling it again once started does nothing. */
+esp_err_t budget_start(void);
+
+/* Watch the stack of `task`, created with `stack_bytes`. Tasks may register before budget_start(). */
+esp_err_t budget_watch(TaskHandle_t task, uint32_t stack_bytes);
+
+/* Sample now and copy the result. */
+void budget_get_stats(budget_stats_t *stats);
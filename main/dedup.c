@@ -0,0 +1,167 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "dedup.h"
+
+typedef struct {
+    dedup_entry_t window;
+    uint32_t hash;
+    uint32_t last_used; //access clock value, lowest is evicted first
+    bool used;
+} dedup_slot_t;
+
+static dedup_slot_t slots[DEDUP_NODES];
+static uint32_t access_clock = 0;
+static dedup_stats_t stats = {0};
+static portMUX_TYPE dedup_lock = portMUX_INITIALIZER_UNLOCKED;
+
+_Static_assert((DEDUP_NODES & (DEDUP_NODES - 1)) == 0, "DEDUP_NODES must be a power of two");
+_Static_assert(DEDUP_WINDOW <= 64, "the window is one uint64_t");
+
+// FNV-1a
+static uint32_t dedup_hash(const char *origin, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)origin[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Slot holding `origin`, or NULL. Call with dedup_lock held.
+static dedup_slot_t *dedup_find(const char *origin, size_t len, uint32_t hash)
+{
+    for (int i = 0; i < DEDUP_WAYS; i++) {
+        dedup_slot_t *slot = &slots[(hash + i) & (DEDUP_NODES - 1)];
+        if (slot->used && slot->hash == hash && strncmp(slot->window.origin, origin, len) == 0 &&
+                slot->window.origin[len] == '\0') {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Slot for `origin`, taking a free or the least recently used one if it is new. Call with dedup_lock held.
+static dedup_slot_t *dedup_slot(const char *origin, size_t len, bool *found)
+{
+    uint32_t hash = dedup_hash(origin, len);
+    dedup_slot_t *victim = dedup_find(origin, len, hash);
+
+    if (victim != NULL) {
+        *found = true;
+        victim->last_used = ++access_clock;
+        return victim;
+    }
+    for (int i = 0; i < DEDUP_WAYS; i++) {
+        dedup_slot_t *slot = &slots[(hash + i) & (DEDUP_NODES - 1)];
+        if (victim == NULL || (victim->used && (!slot->used || (int32_t)(slot->last_used - victim->last_used) < 0))) {
+            victim = slot;
+        }
+    }
+    if (victim->used) {
+        stats.evictions++;
+    }
+    *found = false;
+    memcpy(victim->window.origin, origin, len);
+    victim->window.origin[len] = '\0';
+    victim->hash = hash;
+    victim->last_used = ++access_clock;
+    victim->used = true;
+    return victim;
+}
+
+bool dedup_seen(const char *origin, size_t origin_len, uint32_t seq)
+{
+    bool seen = false;
+    if (origin_len >= DEDUP_ORIGIN_LEN) {
+        origin_len = DEDUP_ORIGIN_LEN - 1;
+    }
+
+    portENTER_CRITICAL(&dedup_lock);
+    dedup_slot_t *slot = dedup_find(origin, origin_len, dedup_hash(origin, origin_len));
+    if (slot != NULL) {
+        int32_t ahead = (int32_t)(seq - slot->window.highest);
+        seen = ahead <= 0 && -(int64_t)ahead < DEDUP_WINDOW && (slot->window.window & (1ULL << -ahead)) != 0;
+    }
+    if (seen) {
+        stats.duplicates++;
+    }
+    portEXIT_CRITICAL(&dedup_lock);
+    return seen;
+}
+
+bool dedup_accept(const char *origin, size_t origin_len, uint32_t seq)
+{
+    bool found = false, fresh = true;
+    if (origin_len >= DEDUP_ORIGIN_LEN) {
+        origin_len = DEDUP_ORIGIN_LEN - 1;
+    }
+
+    portENTER_CRITICAL(&dedup_lock);
+    dedup_slot_t *slot = dedup_slot(origin, origin_len, &found);
+    dedup_entry_t *w = &slot->window;
+    int32_t ahead = (int32_t)(seq - w->highest);
+    if (!found) {
+        w->highest = seq;
+        w->window = 1;
+    } else if (ahead > 0) {
+        w->window = ahead >= DEDUP_WINDOW ? 1 : (w->window << ahead) | 1;
+        w->highest = seq;
+    } else if (-(int64_t)ahead < DEDUP_WINDOW) {
+        uint64_t bit = 1ULL << -ahead;
+        fresh = (w->window & bit) == 0;
+        w->window |= bit;
+    } else {
+        // Too old to be a retransmission: the node restarted its count
+        w->highest = seq;
+        w->window = 1;
+        stats.restarts++;
+    }
+    if (fresh) {
+        stats.accepted++;
+    } else {
+        stats.duplicates++;
+    }
+    portEXIT_CRITICAL(&dedup_lock);
+    return fresh;
+}
+
+size_t dedup_export(dedup_entry_t *entries, size_t max)
+{
+    size_t count = 0;
+    portENTER_CRITICAL(&dedup_lock);
+    for (int i = 0; i < DEDUP_NODES && count < max; i++) {
+        if (slots[i].used) {
+            entries[count++] = slots[i].window;
+        }
+    }
+    portEXIT_CRITICAL(&dedup_lock);
+    return count;
+}
+
+void dedup_merge(const dedup_entry_t *entry)
+{
+    bool found = false;
+    size_t len = strnlen(entry->origin, DEDUP_ORIGIN_LEN - 1);
+
+    portENTER_CRITICAL(&dedup_lock);
+    dedup_slot_t *slot = dedup_slot(entry->origin, len, &found);
+    dedup_entry_t *w = &slot->window;
+    int32_t ahead = (int32_t)(entry->highest - w->highest);
+    if (!found) {
+        w->highest = entry->highest;
+        w->window = entry->window;
+    } else if (ahead >= 0) {
+        w->window = (ahead >= DEDUP_WINDOW ? 0 : w->window << ahead) | entry->window;
+        w->highest = entry->highest;
+    } else if (-(int64_t)ahead < DEDUP_WINDOW) {
+        w->window |= entry->window >> -ahead;
+    }
+    portEXIT_CRITICAL(&dedup_lock);
+}
+
+void dedup_get_stats(dedup_stats_t *out)
+{
+    portENTER_CRITICAL(&dedup_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&dedup_lock);
+}
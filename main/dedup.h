@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Duplicate filter for sequenced frames (NEO_WIRE_FLAG_SEQUENCED). Mesh retransmissions and root
+ * switches can deliver a frame twice; the root keeps, per sending node, the highest sequence number
+ * seen and a bitmap of the DEDUP_WINDOW numbers below it. The table is fixed size and probed like
+ * the patient cache, so a check is O(1) and never allocates. A number far behind the window is taken
+ * as the node having restarted its count, and the window starts over from it. */
+#define DEDUP_NODES 64 //sending nodes tracked, power of two
+#define DEDUP_WAYS 8 //slots probed per lookup, the least recently used one is evicted
+#define DEDUP_WINDOW 64 //sequence numbers remembered behind the highest one
+#define DEDUP_ORIGIN_LEN 32
+
+typedef struct {
+    char origin[DEDUP_ORIGIN_LEN];
+    uint32_t highest;
+    uint64_t window; //bit i set: highest - i was seen
+} dedup_entry_t;
+
+typedef struct {
+    uint32_t accepted;
+    uint32_t duplicates;
+    uint32_t restarts; //windows started over after a jump back
+    uint32_t evictions;
+} dedup_stats_t;
+
+/* Whether frame `seq` from `origin` (not NUL terminated) was recorded before. Counts a duplicate
+ * when it was, records nothing otherwise. */
+bool dedup_seen(const char *origin, size_t origin_len, uint32_t seq);
+
+/* Record frame `seq` from `origin`. Returns false if it was seen before. */
+bool dedup_accept(const char *origin, size_t origin_len, uint32_t seq);
+
+/* Copy up to `max` windows, e.g. to hand them to the next root. Returns the count. */
+size_t dedup_export(dedup_entry_t *entries, size_t max);
+
+/* Merge a window handed over by the previous root into the local one. */
+void dedup_merge(const dedup_entry_t *entry);
+
+void dedup_get_stats(dedup_stats_t *stats);
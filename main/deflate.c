@@ -0,0 +1,190 @@
+#include <stdbool.h>
+#include <string.h>
+#include "esp_rom_crc.h"
+#include "deflate.h"
+
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_END_OF_BLOCK 256
+
+typedef struct {
+    uint8_t *out;
+    size_t len;
+    size_t max;
+    uint32_t bits; //pending bits, least significant first
+    int count;
+    bool full; //output no longer fits, the rest is thrown away
+} deflate_writer_t;
+
+// RFC 1951 section 3.2.5: length codes 257..285 and distance codes 0..29
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+    4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+static void deflate_put_bits(deflate_writer_t *w, uint32_t value, int n)
+{
+    w->bits |= value << w->count;
+    w->count += n;
+    while (w->count >= 8) {
+        if (w->len < w->max) {
+            w->out[w->len++] = (uint8_t)w->bits;
+        } else {
+            w->full = true;
+        }
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+static void deflate_put_bytes(deflate_writer_t *w, const uint8_t *bytes, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        deflate_put_bits(w, bytes[i], 8);
+    }
+}
+
+// Huffman codes go most significant bit first, everything else least significant bit first
+static void deflate_put_code(deflate_writer_t *w, uint32_t code, int n)
+{
+    uint32_t reversed = 0;
+    for (int i = 0; i < n; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    deflate_put_bits(w, reversed, n);
+}
+
+// Fixed literal/length code, RFC 1951 section 3.2.6
+static void deflate_put_symbol(deflate_writer_t *w, int symbol)
+{
+    if (symbol < 144) {
+        deflate_put_code(w, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        deflate_put_code(w, 0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        deflate_put_code(w, symbol - 256, 7);
+    } else {
+        deflate_put_code(w, 0xc0 + symbol - 280, 8);
+    }
+}
+
+static void deflate_put_match(deflate_writer_t *w, size_t len, size_t distance)
+{
+    int l = 28;
+    while (length_base[l] > len) {
+        l--;
+    }
+    deflate_put_symbol(w, 257 + l);
+    deflate_put_bits(w, len - length_base[l], length_extra[l]);
+    int d = 29;
+    while (distance_base[d] > distance) {
+        d--;
+    }
+    deflate_put_code(w, d, 5);
+    deflate_put_bits(w, distance - distance_base[d], distance_extra[d]);
+}
+
+static uint32_t deflate_hash(const uint8_t *p)
+{
+    return (((uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2]) * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+static uint32_t deflate_adler32(const uint8_t *data, size_t len)
+{
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < len; i++) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return b << 16 | a;
+}
+
+esp_err_t deflate_encode(deflate_format_t format, const void *in, size_t in_len, deflate_scratch_t *scratch,
+                         uint8_t *out, size_t out_max, size_t *out_len)
+{
+    static const uint8_t gzip_header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff }; //deflate, no name, unknown OS
+    static const uint8_t zlib_header[2] = { 0x78, 0x01 }; //32K window, fastest
+    const uint8_t *p = in;
+    deflate_writer_t w = { .out = out, .max = out_max };
+
+    if ((format != DEFLATE_ZLIB && format != DEFLATE_GZIP) || (in == NULL && in_len > 0) ||
+            in_len > DEFLATE_MAX_INPUT || scratch == NULL || out == NULL || out_len == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (format == DEFLATE_GZIP) {
+        deflate_put_bytes(&w, gzip_header, sizeof(gzip_header));
+    } else {
+        deflate_put_bytes(&w, zlib_header, sizeof(zlib_header));
+    }
+    memset(scratch->head, 0, sizeof(scratch->head));
+    deflate_put_bits(&w, 1, 1); // final block
+    deflate_put_bits(&w, 1, 2); // fixed Huffman codes
+
+    size_t i = 0;
+    while (i < in_len && !w.full) {
+        size_t len = 0;
+        size_t distance = 0;
+        if (in_len - i >= DEFLATE_MIN_MATCH) {
+            uint32_t h = deflate_hash(p + i);
+            size_t candidate = scratch->head[h];
+            scratch->head[h] = i + 1;
+            if (candidate > 0) {
+                candidate--;
+                size_t limit = in_len - i < DEFLATE_MAX_MATCH ? in_len - i : DEFLATE_MAX_MATCH;
+                while (len < limit && p[candidate + len] == p[i + len]) {
+                    len++;
+                }
+                distance = i - candidate;
+            }
+        }
+        if (len < DEFLATE_MIN_MATCH) {
+            deflate_put_symbol(&w, p[i++]);
+            continue;
+        }
+        deflate_put_match(&w, len, distance);
+        // Positions inside the match can start later matches too
+        for (size_t j = i + 1; j < i + len && in_len - j >= DEFLATE_MIN_MATCH; j++) {
+            scratch->head[deflate_hash(p + j)] = j + 1;
+        }
+        i += len;
+    }
+    deflate_put_symbol(&w, DEFLATE_END_OF_BLOCK);
+    if (w.count > 0) {
+        deflate_put_bits(&w, 0, 8 - w.count);
+    }
+
+    if (format == DEFLATE_GZIP) {
+        uint32_t crc = esp_rom_crc32_le(0, p, in_len);
+        uint8_t trailer[8] = {
+            crc, crc >> 8, crc >> 16, crc >> 24, in_len, in_len >> 8, in_len >> 16, in_len >> 24,
+        };
+        deflate_put_bytes(&w, trailer, sizeof(trailer));
+    } else {
+        uint32_t adler = deflate_adler32(p, in_len);
+        uint8_t trailer[4] = { adler >> 24, adler >> 16, adler >> 8, adler };
+        deflate_put_bytes(&w, trailer, sizeof(trailer));
+    }
+    if (w.full) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *out_len = w.len;
+    return ESP_OK;
+}
+
+const char *deflate_content_encoding(deflate_format_t format)
+{
+    switch (format) {
+    case DEFLATE_ZLIB: return "deflate";
+    case DEFLATE_GZIP: return "gzip";
+    default: return NULL;
+    }
+}
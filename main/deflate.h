@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Small deflate encoder for request bodies (RFC 1951, wrapped as RFC 1950 zlib or RFC 1952 gzip).
+ * One pass, greedy LZ77 with a single hash head per three-byte prefix and one fixed Huffman block:
+ * no window copy, no dynamic trees, the only state is the hash table, so it runs on an uploader
+ * task's stack budget. The repeated keys of a JSON array of readings still shrink to a few bits
+ * each. Output is written as it is produced and the encoder gives up as soon as it would not save
+ * anything, so a body that does not compress costs at most one pass. */
+#define DEFLATE_HASH_BITS 10 //hash table of 2^n 16-bit positions
+#define DEFLATE_MAX_INPUT 32768 //every match stays within the deflate window
+#define DEFLATE_OVERHEAD 18 //gzip header and trailer, the larger wrapper
+
+typedef enum {
+    DEFLATE_NONE, //send the body as it is
+    DEFLATE_ZLIB, //Content-Encoding: deflate
+    DEFLATE_GZIP, //Content-Encoding: gzip
+} deflate_format_t;
+
+typedef struct {
+    uint16_t head[1 << DEFLATE_HASH_BITS]; //last position + 1 seen for each hash, 0 if none
+} deflate_scratch_t;
+
+/* Compress `in` into `out`. Returns ESP_ERR_INVALID_SIZE, with `out` unusable, when the result
+ * would not fit in `out_max` bytes; pass less than `in_len` to only keep output that is smaller. */
+esp_err_t deflate_encode(deflate_format_t format, const void *in, size_t in_len, deflate_scratch_t *scratch,
+                         uint8_t *out, size_t out_max, size_t *out_len);
+
+/* Content-Encoding header value, NULL for DEFLATE_NONE. */
+const char *deflate_content_encoding(deflate_format_t format);
@@ -0,0 +1,179 @@
+#include <string.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "budget.h"
+#include "dns_cache.h"
+
+#define DNS_CACHE_STACK 3072
+
+static const char *TAG = "neoDNS";
+static const char *dns_host = NULL;
+static const char *dns_port = NULL;
+static int64_t dns_ttl_us = 0;
+static struct sockaddr_in cached[DNS_CACHE_MAX_ADDRS];
+static int cached_count = 0;
+static int64_t expires_us = 0;
+static TaskHandle_t refresh_task = NULL;
+static dns_cache_stats_t stats = {0};
+static portMUX_TYPE dns_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Run getaddrinfo and replace the cached addresses. Keeps the old ones on failure.
+static esp_err_t dns_cache_lookup(void)
+{
+    struct addrinfo hints = {0};
+    struct addrinfo *res = NULL, *p = NULL;
+    struct sockaddr_in found[DNS_CACHE_MAX_ADDRS];
+    int count = 0;
+
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(dns_host, dns_port, &hints, &res) != 0 || res == NULL) {
+        return ESP_FAIL;
+    }
+    for (p = res; p != NULL && count < DNS_CACHE_MAX_ADDRS; p = p->ai_next) {
+        if (p->ai_family == AF_INET && p->ai_addrlen >= sizeof(struct sockaddr_in)) {
+            memcpy(&found[count++], p->ai_addr, sizeof(struct sockaddr_in));
+        }
+    }
+    freeaddrinfo(res);
+    if (count == 0) {
+        return ESP_FAIL;
+    }
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&dns_lock);
+    memcpy(cached, found, count * sizeof(found[0]));
+    cached_count = count;
+    expires_us = now + dns_ttl_us;
+    portEXIT_CRITICAL(&dns_lock);
+    return ESP_OK;
+}
+
+static void dns_cache_task(void *arg)
+{
+    while (true) {
+        portENTER_CRITICAL(&dns_lock);
+        int64_t refresh_at = expires_us - DNS_CACHE_REFRESH_AHEAD_MS * 1000LL;
+        portEXIT_CRITICAL(&dns_lock);
+
+        // Sleep until the refresh is due or someone asks for one
+        int64_t wait_ms = (refresh_at - esp_timer_get_time()) / 1000;
+        if (wait_ms > 0) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+        }
+        esp_err_t err = dns_cache_lookup();
+        portENTER_CRITICAL(&dns_lock);
+        if (err == ESP_OK) {
+            stats.refreshes++;
+        } else {
+            stats.refresh_failures++;
+        }
+        portEXIT_CRITICAL(&dns_lock);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Refreshing %s failed, keeping last-known-good address", dns_host);
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DNS_CACHE_RETRY_MS));
+        }
+    }
+}
+
+esp_err_t dns_cache_init(const char *host, const char *port, uint32_t ttl_ms)
+{
+    if (host == NULL || port == NULL || ttl_ms <= DNS_CACHE_REFRESH_AHEAD_MS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (refresh_task != NULL) {
+        return ESP_OK; // already running
+    }
+    dns_host = host;
+    dns_port = port;
+    dns_ttl_us = ttl_ms * 1000LL;
+    if (dns_cache_lookup() != ESP_OK) {
+        // Not fatal: the first connection attempt resolves again
+        ESP_LOGW(TAG, "DNS lookup failed for host %s", host);
+    }
+    if (xTaskCreate(dns_cache_task, "neoDNS", DNS_CACHE_STACK, NULL, 4, &refresh_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    budget_watch(refresh_task, DNS_CACHE_STACK);
+    return ESP_OK;
+}
+
+esp_err_t dns_cache_resolve(struct sockaddr_in *addrs, int max, int *count)
+{
+    int64_t now = esp_timer_get_time();
+    bool have = false, fresh = false;
+
+    portENTER_CRITICAL(&dns_lock);
+    have = cached_count > 0;
+    fresh = have && now < expires_us;
+    if (fresh) {
+        stats.hits++;
+    } else if (have) {
+        stats.stale++;
+    } else {
+        stats.misses++;
+    }
+    portEXIT_CRITICAL(&dns_lock);
+
+    if (!have) {
+        // Nothing ever resolved: the caller has to wait for the resolver
+        if (dns_cache_lookup() != ESP_OK) {
+            ESP_LOGE(TAG, "DNS lookup failed for host %s", dns_host);
+            return ESP_ERR_NOT_FOUND;
+        }
+    } else if (!fresh) {
+        dns_cache_refresh();
+    }
+
+    portENTER_CRITICAL(&dns_lock);
+    *count = cached_count < max ? cached_count : max;
+    memcpy(addrs, cached, *count * sizeof(cached[0]));
+    portEXIT_CRITICAL(&dns_lock);
+    return ESP_OK;
+}
+
+void dns_cache_refresh(void)
+{
+    if (refresh_task != NULL) {
+        xTaskNotifyGive(refresh_task);
+    }
+}
+
+int dns_cache_export(struct sockaddr_in *addrs, int max)
+{
+    portENTER_CRITICAL(&dns_lock);
+    int count = cached_count < max ? cached_count : max;
+    memcpy(addrs, cached, count * sizeof(cached[0]));
+    portEXIT_CRITICAL(&dns_lock);
+    return count;
+}
+
+void dns_cache_seed(const struct sockaddr_in *addrs, int count)
+{
+    if (count <= 0) {
+        return;
+    }
+    portENTER_CRITICAL(&dns_lock);
+    bool empty = cached_count == 0;
+    if (empty) {
+        cached_count = count < DNS_CACHE_MAX_ADDRS ? count : DNS_CACHE_MAX_ADDRS;
+        memcpy(cached, addrs, cached_count * sizeof(cached[0]));
+        expires_us = esp_timer_get_time(); // stale at once, so the first use triggers a refresh
+    }
+    portEXIT_CRITICAL(&dns_lock);
+    if (empty) {
+        ESP_LOGI(TAG, "Using %d address(es) from the previous root for %s", count, dns_host);
+    }
+}
+
+void dns_cache_get_stats(dns_cache_stats_t *out)
+{
+    portENTER_CRITICAL(&dns_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&dns_lock);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "esp_err.h"
+
+#define DNS_CACHE_MAX_ADDRS 4 //addresses kept per lookup
+#define DNS_CACHE_REFRESH_AHEAD_MS (30 * 1000) //refresh this long before the entry expires
+#define DNS_CACHE_RETRY_MS (10 * 1000) //delay between failed refreshes
+
+typedef struct {
+    uint32_t hits; //answered from a fresh entry
+    uint32_t misses; //had to resolve in the caller's task
+    uint32_t stale; //answered from an expired, last-known-good entry
+    uint32_t refreshes; //successful background lookups
+    uint32_t refresh_failures;
+} dns_cache_stats_t;
+
+/* Resolve host:port once now and keep it for `ttl_ms`, refreshing it from a background task. */
+esp_err_t dns_cache_init(const char *host, const char *port, uint32_t ttl_ms);
+
+/* Copy up to `max` cached IPv4 addresses into `addrs`. If the cache has expired and the
+ * resolver keeps failing, the last-known-good addresses are returned. */
+esp_err_t dns_cache_resolve(struct sockaddr_in *addrs, int max, int *count);
+
+/* Ask the background task to look the host up again, e.g. after none of the addresses answered. */
+void dns_cache_refresh(void);
+
+/* Copy up to `max` cached addresses without touching the stats. Returns how many were copied. */
+int dns_cache_export(struct sockaddr_in *addrs, int max);
+
+/* Use addresses handed over by the previous root if nothing was resolved yet. They are served as
+ * last-known-good while a fresh lookup runs in the background. */
+void dns_cache_seed(const struct sockaddr_in *addrs, int count);
+
+void dns_cache_get_stats(dns_cache_stats_t *stats);
@@ -0,0 +1,244 @@
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "budget.h"
+#include "metrics.h"
+#include "duty.h"
+
+#define DUTY_STACK 3072
+
+static const char *TAG = "neoDuty";
+static duty_config_t duty_config;
+static uint32_t frames = 0; //since the last period
+static int child_duty[DUTY_MAX_CHILDREN]; //by association ID - 1, 0 when unknown
+static duty_stats_t stats = {0};
+static portMUX_TYPE duty_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int duty_clamp(int duty, int low, int high)
+{
+    return duty < low ? low : duty > high ? high : duty;
+}
+
+// Frames or readings waiting anywhere on this node
+static uint32_t duty_backlog(void)
+{
+    mesh_tx_pending_t tx;
+    mesh_rx_pending_t rx;
+    uint32_t backlog = 0;
+
+    if (esp_mesh_get_tx_pending(&tx) == ESP_OK) {
+        backlog += tx.to_parent + tx.to_parent_p2p + tx.to_child + tx.to_child_p2p;
+    }
+    if (esp_mesh_get_rx_pending(&rx) == ESP_OK) {
+        backlog += rx.toDS + rx.toSelf;
+    }
+    if (duty_config.backlog != NULL) {
+        backlog += duty_config.backlog(duty_config.ctx);
+    }
+    return backlog;
+}
+
+static void duty_set_device(int duty, const char *reason)
+{
+    esp_err_t err = esp_mesh_set_active_duty_cycle(duty, duty_config.dev_type);
+    portENTER_CRITICAL(&duty_lock);
+    int was = stats.device;
+    if (err == ESP_OK) {
+        stats.device = duty;
+        if (duty > was) {
+            stats.ups++;
+        } else {
+            stats.downs++;
+        }
+    } else {
+        stats.failures++;
+    }
+    portEXIT_CRITICAL(&duty_lock);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Device duty cycle %d%% refused: %s", duty, esp_err_to_name(err));
+        return;
+    }
+    metrics_count(duty > was ? METRIC_DUTY_UP : METRIC_DUTY_DOWN);
+    ESP_LOGI(TAG, "Device duty cycle %d%% -> %d%% (%s)", was, duty, reason);
+}
+
+// Only the root's setting reaches the mesh; it follows the device duty cycle within its own bounds
+static void duty_set_network(int device)
+{
+    int span = duty_config.dev_max - duty_config.dev_min;
+    int duty = duty_config.nwk_min;
+    if (span > 0) {
+        duty += (device - duty_config.dev_min) * (duty_config.nwk_max - duty_config.nwk_min) / span;
+    }
+    if (duty == stats.network) {
+        return;
+    }
+    esp_err_t err = esp_mesh_set_network_duty_cycle(duty, duty_config.nwk_duration, duty_config.nwk_rule);
+    portENTER_CRITICAL(&duty_lock);
+    if (err == ESP_OK) {
+        stats.network = duty;
+    } else {
+        stats.failures++;
+    }
+    portEXIT_CRITICAL(&duty_lock);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Network duty cycle %d%% refused: %s", duty, esp_err_to_name(err));
+        return;
+    }
+    ESP_LOGI(TAG, "Network duty cycle %d%%", duty);
+}
+
+static void duty_log_stats(void)
+{
+    duty_stats_t s;
+    duty_get_stats(&s);
+    ESP_LOGI(TAG, "device:%d%%, network:%d%%, parent:%d%%, busiest child:%d%%, descendants:%d, fps:%.1f, backlog:%" PRIu32 ", ups:%" PRIu32 ", downs:%" PRIu32 ", failures:%" PRIu32,
+             s.device, s.network, s.parent, s.busiest_child, s.descendants, s.fps, s.backlog, s.ups, s.downs,
+             s.failures);
+}
+
+static void duty_task(void *arg)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    int64_t next_stats = esp_timer_get_time() + DUTY_STATS_MS * 1000LL;
+    int idle_run = 0;
+
+    while (true) {
+        xTaskDelayUntil(&last_wake, pdMS_TO_TICKS(duty_config.period_ms));
+        uint32_t backlog = duty_backlog();
+        int descendants = esp_mesh_get_routing_table_size() - 1;
+        descendants = descendants > 0 ? descendants : 0;
+
+        portENTER_CRITICAL(&duty_lock);
+        float fps = frames * 1000.0f / duty_config.period_ms;
+        frames = 0;
+        int busiest_child = 0;
+        for (int i = 0; i < DUTY_MAX_CHILDREN; i++) {
+            busiest_child = child_duty[i] > busiest_child ? child_duty[i] : busiest_child;
+        }
+        int device = stats.device;
+        int parent = stats.parent;
+        stats.fps = fps;
+        stats.backlog = backlog;
+        stats.descendants = descendants;
+        stats.busiest_child = busiest_child;
+        portEXIT_CRITICAL(&duty_lock);
+
+        // Nodes that forward for others stay awake at least as much as those they forward for
+        int floor = duty_clamp(duty_config.dev_min + descendants * duty_config.per_descendant,
+                               duty_config.dev_min, duty_config.dev_max);
+        floor = duty_clamp(busiest_child, floor, duty_config.dev_max);
+
+        int target = device;
+        const char *reason = NULL;
+        if (fps >= duty_config.busy_fps || backlog >= duty_config.busy_backlog) {
+            // Catch up with an uplink that is already awake more, rather than doubling towards it
+            idle_run = 0;
+            target = parent > device * 2 ? parent : device * 2;
+            reason = "busy";
+        } else if (fps <= duty_config.idle_fps && backlog == 0) {
+            if (++idle_run >= duty_config.idle_periods) {
+                idle_run = 0;
+                target = device - duty_config.step_down;
+                reason = "idle";
+            }
+        } else {
+            idle_run = 0;
+        }
+        int bounded = duty_clamp(target, floor, duty_config.dev_max);
+        if (bounded > target || reason == NULL) {
+            reason = "floor";
+        }
+        if (bounded != device) {
+            duty_set_device(bounded, reason);
+        }
+
+        if (esp_mesh_is_root()) {
+            portENTER_CRITICAL(&duty_lock);
+            device = stats.device;
+            portEXIT_CRITICAL(&duty_lock);
+            duty_set_network(device);
+        } else if (stats.network != 0) {
+            // The next root owns the network duty cycle, set it again if this node is root once more
+            portENTER_CRITICAL(&duty_lock);
+            stats.network = 0;
+            portEXIT_CRITICAL(&duty_lock);
+        }
+
+        if (esp_timer_get_time() >= next_stats) {
+            duty_log_stats();
+            next_stats += DUTY_STATS_MS * 1000LL;
+        }
+    }
+}
+
+esp_err_t duty_start(const duty_config_t *config)
+{
+    static bool is_started = false;
+    if (is_started) {
+        return ESP_OK;
+    }
+    if (config == NULL || config->dev_min < 10 || config->dev_max > 100 || config->dev_min > config->dev_max ||
+            config->dev_start < config->dev_min || config->dev_start > config->dev_max ||
+            config->nwk_min < 10 || config->nwk_max > 100 || config->nwk_min > config->nwk_max ||
+            config->period_ms == 0 || config->idle_fps >= config->busy_fps || config->idle_periods < 1 ||
+            config->step_down < 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    duty_config = *config;
+    esp_err_t err = esp_mesh_set_active_duty_cycle(config->dev_start, config->dev_type);
+    if (err != ESP_OK) {
+        return err;
+    }
+    stats.device = config->dev_start;
+    TaskHandle_t task = NULL;
+    if (xTaskCreate(duty_task, "neoDuty", DUTY_STACK, NULL, 3, &task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    budget_watch(task, DUTY_STACK);
+    is_started = true;
+    ESP_LOGI(TAG, "Device duty cycle %d%% (%d-%d%%), network %d-%d%%, busy at %.1f frames/s or %" PRIu32 " waiting",
+             config->dev_start, config->dev_min, config->dev_max, config->nwk_min, config->nwk_max,
+             config->busy_fps, config->busy_backlog);
+    return ESP_OK;
+}
+
+void duty_count_frames(uint32_t n)
+{
+    portENTER_CRITICAL(&duty_lock);
+    frames += n;
+    portEXIT_CRITICAL(&duty_lock);
+}
+
+void duty_parent_duty(int duty)
+{
+    portENTER_CRITICAL(&duty_lock);
+    stats.parent = duty;
+    portEXIT_CRITICAL(&duty_lock);
+}
+
+void duty_child_duty(int aid, int duty)
+{
+    if (aid < 1 || aid > DUTY_MAX_CHILDREN) {
+        return;
+    }
+    portENTER_CRITICAL(&duty_lock);
+    child_duty[aid - 1] = duty;
+    portEXIT_CRITICAL(&duty_lock);
+}
+
+void duty_child_gone(int aid)
+{
+    duty_child_duty(aid, 0);
+}
+
+void duty_get_stats(duty_stats_t *out)
+{
+    portENTER_CRITICAL(&duty_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&duty_lock);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Power-save duty cycle controller. Every period it looks at the frames this node handled, the
+ * data waiting in the mesh stack and in the application, how many nodes route through it and the
+ * duty cycles its parent and children announced. Busy periods double the device duty cycle at once;
+ * only a run of idle periods steps it back down, so a short lull does not cost latency. A busy node
+ * jumps straight to its parent's duty cycle if that is higher, and a forwarding node never drops
+ * below its busiest child's, so a rise spreads up the tree towards the root. The root also moves the
+ * network duty cycle, in proportion, since it is the only node whose setting reaches the whole mesh. */
+#define DUTY_STATS_MS 60000 //how often the controller state is logged
+#define DUTY_MAX_CHILDREN 16 //children whose announced duty cycle is remembered, by association ID
+
+typedef uint32_t (*duty_backlog_fn)(void *ctx); //application items waiting to be sent
+
+typedef struct {
+    int dev_min; //device duty cycle bounds, percent (10 to 100)
+    int dev_max;
+    int dev_start;
+    int dev_type; //MESH_PS_DEVICE_DUTY_REQUEST or MESH_PS_DEVICE_DUTY_DEMAND
+    int nwk_min; //network duty cycle bounds, only set while root
+    int nwk_max;
+    int nwk_duration; //minutes, -1 for as long as the root stays
+    int nwk_rule; //MESH_PS_NETWORK_DUTY_APPLIED_ENTIRE or _UPLINK
+    int per_descendant; //device duty cycle floor raised this much per node routing through here
+    uint32_t period_ms; //how often the load is sampled
+    float busy_fps; //frames per second at or above which a period is busy
+    float idle_fps; //frames per second at or below which a period may be idle, below busy_fps
+    uint32_t busy_backlog; //frames or readings waiting at or above which a period is busy
+    int idle_periods; //consecutive idle periods before stepping down
+    int step_down; //percent taken off per step down
+    duty_backlog_fn backlog; //optional
+    void *ctx;
+} duty_config_t;
+
+typedef struct {
+    int device; //current device duty cycle
+    int network; //current network duty cycle, 0 if never set
+    int parent; //last duty cycle the parent announced, 0 if none
+    int busiest_child; //highest duty cycle a connected child announced, 0 if none
+    int descendants;
+    float fps; //frames per second over the last period
+    uint32_t backlog; //waiting over the last period
+    uint32_t ups;
+    uint32_t downs;
+    uint32_t failures; //duty cycle changes the mesh stack refused
+} duty_stats_t;
+
+/* Apply the starting duty cycles and start the controller task. Call after esp_mesh_start() with
+ * power save enabled. Calling it again once started does nothing. */
+esp_err_t duty_start(const duty_config_t *config);
+
+/* Count frames sent or received by this node, the controller's measure of traffic. */
+void duty_count_frames(uint32_t frames);
+
+/* Feed MESH_EVENT_PS_PARENT_DUTY, MESH_EVENT_PS_CHILD_DUTY and MESH_EVENT_CHILD_DISCONNECTED. */
+void duty_parent_duty(int duty);
+void duty_child_duty(int aid, int duty);
+void duty_child_gone(int aid);
+
+void duty_get_stats(duty_stats_t *stats);
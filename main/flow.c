@@ -0,0 +1,136 @@
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "flow.h"
+
+static const char *TAG = "neoFlow";
+static const char *NVS_NAMESPACE = "neolink";
+static const char *NVS_KEY = "xon_peak";
+
+static flow_config_t flow_config;
+static int64_t changed_us = 0; //last stretch change
+static int64_t announced_us = 0; //last hint handed out
+static int64_t saved_us = 0;
+static uint32_t saved_peak = 0;
+static flow_stats_t stats = { .stretch = 1 };
+static portMUX_TYPE flow_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t flow_load_peak(void)
+{
+    nvs_handle_t handle;
+    uint32_t peak = 0;
+    size_t size = sizeof(peak);
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return 0;
+    }
+    if (nvs_get_blob(handle, NVS_KEY, &peak, &size) != ESP_OK || size != sizeof(peak)) {
+        peak = 0;
+    }
+    nvs_close(handle);
+    return peak;
+}
+
+static void flow_save_peak(uint32_t peak)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, NVS_KEY, &peak, sizeof(peak));
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Saving receive queue high water mark failed: %s", esp_err_to_name(err));
+        return;
+    }
+    saved_peak = peak;
+}
+
+esp_err_t flow_init(const flow_config_t *config)
+{
+    if (config == NULL || config->low_pct >= config->high_pct || config->high_pct > 100 ||
+            config->max_stretch < 1 || config->max_stretch > FLOW_STRETCH_MAX || config->ttl_s < 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&flow_lock);
+    flow_config = *config;
+    stats.stretch = 1;
+    changed_us = 0;
+    announced_us = 0;
+    portEXIT_CRITICAL(&flow_lock);
+    return ESP_OK;
+}
+
+bool flow_update(uint32_t mesh_pending, uint32_t mesh_capacity, uint32_t queue_depth, uint32_t queue_capacity,
+                 int64_t now_us, neo_wire_hint_t *hint)
+{
+    uint32_t mesh_pct = mesh_capacity > 0 ? mesh_pending * 100 / mesh_capacity : 0;
+    uint32_t queue_pct = queue_capacity > 0 ? queue_depth * 100 / queue_capacity : 0;
+    uint32_t occupancy = mesh_pct > queue_pct ? mesh_pct : queue_pct;
+    bool announce = false;
+    uint32_t peak = 0;
+
+    portENTER_CRITICAL(&flow_lock);
+    uint8_t was = stats.stretch;
+    stats.occupancy_pct = occupancy > 100 ? 100 : occupancy;
+    stats.peak_pct = stats.occupancy_pct > stats.peak_pct ? stats.occupancy_pct : stats.peak_pct;
+    stats.mesh_peak = mesh_pending > stats.mesh_peak ? mesh_pending : stats.mesh_peak;
+    if (now_us - changed_us >= flow_config.step_ms * 1000LL) {
+        if (occupancy >= flow_config.high_pct && stats.stretch < flow_config.max_stretch) {
+            stats.stretch = stats.stretch * 2 > flow_config.max_stretch ? flow_config.max_stretch : stats.stretch * 2;
+            stats.slowdowns++;
+        } else if (occupancy <= flow_config.low_pct && stats.stretch > 1) {
+            stats.stretch /= 2;
+            stats.recoveries++;
+        }
+    }
+    if (stats.stretch != was) {
+        changed_us = now_us;
+        announce = true;
+    } else if (stats.stretch > 1 && now_us - announced_us >= flow_config.ttl_s * 500000LL) {
+        announce = true; // keep it from lapsing
+    }
+    uint8_t stretch = stats.stretch;
+    if (announce) {
+        announced_us = now_us;
+        stats.hints++;
+        hint->stretch = stats.stretch;
+        hint->ttl_s = flow_config.ttl_s;
+    }
+    // Saved after FLOW_SAVE_MS of uptime at the earliest, so a quiet boot can also shrink the queue
+    if (stats.mesh_peak != saved_peak && now_us - saved_us >= FLOW_SAVE_MS * 1000LL) {
+        saved_us = now_us;
+        peak = stats.mesh_peak;
+    }
+    portEXIT_CRITICAL(&flow_lock);
+
+    if (stretch != was) {
+        ESP_LOGI(TAG, "Occupancy %" PRIu32 "%%, asking sensors to stretch x%d (was x%d)", occupancy, stretch, was);
+    }
+    if (peak > 0) {
+        flow_save_peak(peak);
+    }
+    return announce;
+}
+
+int flow_xon_qsize(uint32_t free_heap)
+{
+    saved_peak = flow_load_peak();
+    int size = saved_peak > 0 ? saved_peak * FLOW_XON_HEADROOM : FLOW_XON_DEFAULT;
+    int by_heap = free_heap / FLOW_XON_HEAP_SHARE / FLOW_XON_SLOT_BYTES;
+    size = size > by_heap ? by_heap : size;
+    size = size < FLOW_XON_MIN ? FLOW_XON_MIN : size > FLOW_XON_MAX ? FLOW_XON_MAX : size;
+    ESP_LOGI(TAG, "Receive queue %d (high water mark %" PRIu32 ", room for %d in the heap)", size, saved_peak, by_heap);
+    return size;
+}
+
+void flow_get_stats(flow_stats_t *out)
+{
+    portENTER_CRITICAL(&flow_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&flow_lock);
+}
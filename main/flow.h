@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "neo_wire.h"
+
+/* Backpressure from the root to the sensors. The root watches how full its mesh receive queue and
+ * upload queue are. When either stays above high_pct it doubles a stretch factor and broadcasts it;
+ * sensors then wait that many times longer before sending a frame, so they send fewer, fuller
+ * frames and less airtime goes to packets the root cannot take. Below low_pct the stretch halves
+ * again. Hints lapse on the sensors after ttl_s, so one that is lost never throttles them for long;
+ * the root repeats a hint every ttl_s / 2 while it holds.
+ * The mesh receive queue (xon) can only be sized before the mesh starts, so its high water mark is
+ * kept in NVS and the next boot sizes the queue from it and from the free heap. A queue that filled
+ * up grows, one that stayed mostly empty shrinks and leaves the heap to the rest. */
+#define FLOW_STRETCH_MAX 16
+#define FLOW_XON_DEFAULT 128 //receive queue size without a saved high water mark
+#define FLOW_XON_MIN 32
+#define FLOW_XON_MAX 256
+#define FLOW_XON_HEADROOM 2 //queue size as a multiple of the saved high water mark
+#define FLOW_XON_HEAP_SHARE 2 //a full queue takes at most 1/n of the free heap
+#define FLOW_XON_SLOT_BYTES 1500 //heap a queued packet can take, about MESH_MPS
+#define FLOW_SAVE_MS (10 * 60 * 1000) //a new high water mark is saved at most this often
+
+typedef struct {
+    uint8_t high_pct; //occupancy at or above which sensors are asked to slow down
+    uint8_t low_pct; //occupancy at or below which they may speed up again
+    uint8_t max_stretch; //at most FLOW_STRETCH_MAX
+    uint32_t step_ms; //the stretch changes at most this often
+    uint16_t ttl_s; //how long sensors keep a hint
+} flow_config_t;
+
+typedef struct {
+    uint8_t stretch; //current stretch, 1 when not throttling
+    uint8_t occupancy_pct; //at the last update
+    uint8_t peak_pct;
+    uint32_t mesh_peak; //mesh receive queue high water mark
+    uint32_t slowdowns; //times the stretch went up
+    uint32_t recoveries; //times it came down
+    uint32_t hints; //hints handed out to be broadcast
+} flow_stats_t;
+
+/* Reset the stretch to 1, e.g. when this node becomes root. */
+esp_err_t flow_init(const flow_config_t *config);
+
+/* Feed the current mesh receive backlog and upload queue depth. Returns true when `hint` should be
+ * broadcast to the sensors: the stretch changed, or a hint in force is due to be repeated. */
+bool flow_update(uint32_t mesh_pending, uint32_t mesh_capacity, uint32_t queue_depth, uint32_t queue_capacity,
+                 int64_t now_us, neo_wire_hint_t *hint);
+
+/* Receive queue size for esp_mesh_set_xon_qsize(), from the saved high water mark and `free_heap`. */
+int flow_xon_qsize(uint32_t free_heap);
+
+void flow_get_stats(flow_stats_t *stats);
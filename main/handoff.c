@@ -0,0 +1,201 @@
+#include <string.h>
+#include <sys/socket.h>
+#include "esp_log.h"
+#include "dedup.h"
+#include "dns_cache.h"
+#include "neo_wire.h"
+#include "patient_cache.h"
+#include "handoff.h"
+
+static const char *TAG = "neoHandoff";
+static uint8_t frame[NEO_WIRE_MAX_FRAME]; //only used by the task yielding the root
+static neo_wire_writer_t writer;
+static union {
+    char patient_ids[PATIENT_CACHE_SIZE][PATIENT_ID_LEN];
+    dedup_entry_t windows[DEDUP_NODES];
+} snapshot; //staging, one kind at a time
+
+esp_err_t handoff_send_readings(handoff_send_fn send, void *ctx, const mesh_message_t *msgs, size_t count,
+                                bool critical, size_t *sent)
+{
+    esp_err_t err = ESP_OK;
+    *sent = 0;
+    while (*sent < count && err == ESP_OK) {
+        size_t n = 0, len = 0;
+        neo_wire_writer_init(&writer, frame, sizeof(frame));
+        writer.flags = critical ? NEO_WIRE_FLAG_CRITICAL : 0;
+        while (*sent + n < count) {
+            neo_value_t value;
+            if (neo_value_parse(msgs[*sent + n].sensor_data, &value) != ESP_OK ||
+                    neo_wire_add(&writer, msgs[*sent + n].sensor_id, msgs[*sent + n].patient_id, &value) != ESP_OK) {
+                break;
+            }
+            n++;
+        }
+        if (n == 0) {
+            // Not even one reading fits a frame, trying again would never end
+            ESP_LOGE(TAG, "Reading from %s cannot be handed off", msgs[*sent].sensor_id);
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        err = neo_wire_finish(&writer, &len);
+        if (err == ESP_OK) {
+            err = send(ctx, frame, len);
+        }
+        if (err == ESP_OK) {
+            *sent += n;
+        }
+    }
+    return err;
+}
+
+static uint8_t *handoff_header(handoff_kind_t kind)
+{
+    frame[0] = HANDOFF_MAGIC;
+    frame[1] = HANDOFF_VERSION;
+    frame[2] = kind;
+    frame[3] = 0; // entry count
+    return frame + HANDOFF_HEADER_LEN;
+}
+
+esp_err_t handoff_send_snapshot(handoff_send_fn send, void *ctx, uint32_t *patients)
+{
+    struct sockaddr_in addrs[DNS_CACHE_MAX_ADDRS];
+    int addr_count = dns_cache_export(addrs, DNS_CACHE_MAX_ADDRS);
+    esp_err_t err = ESP_OK;
+
+    *patients = 0;
+    if (addr_count > 0) {
+        uint8_t *p = handoff_header(HANDOFF_DNS);
+        for (int i = 0; i < addr_count; i++) {
+            memcpy(p, &addrs[i].sin_addr.s_addr, 4);
+            memcpy(p + 4, &addrs[i].sin_port, 2);
+            p += 6;
+        }
+        frame[3] = addr_count;
+        err = send(ctx, frame, p - frame);
+    }
+
+    size_t count = patient_cache_export(snapshot.patient_ids, PATIENT_CACHE_SIZE);
+    size_t done = 0;
+    while (err == ESP_OK && done < count) {
+        uint8_t *p = handoff_header(HANDOFF_PATIENTS);
+        size_t n = 0;
+        while (done + n < count && n < UINT8_MAX) {
+            size_t len = strnlen(snapshot.patient_ids[done + n], PATIENT_ID_LEN - 1);
+            if (p + 1 + len > frame + sizeof(frame)) {
+                break;
+            }
+            *p++ = len;
+            memcpy(p, snapshot.patient_ids[done + n], len);
+            p += len;
+            n++;
+        }
+        frame[3] = n;
+        err = send(ctx, frame, p - frame);
+        if (err == ESP_OK) {
+            done += n;
+        }
+    }
+    *patients = done;
+
+    count = dedup_export(snapshot.windows, DEDUP_NODES);
+    done = 0;
+    while (err == ESP_OK && done < count) {
+        uint8_t *p = handoff_header(HANDOFF_DEDUP);
+        size_t n = 0;
+        while (done + n < count && n < UINT8_MAX) {
+            const dedup_entry_t *w = &snapshot.windows[done + n];
+            size_t len = strnlen(w->origin, DEDUP_ORIGIN_LEN - 1);
+            if (p + 1 + len + 12 > frame + sizeof(frame)) {
+                break;
+            }
+            *p++ = len;
+            memcpy(p, w->origin, len);
+            p += len;
+            for (int i = 0; i < 4; i++) {
+                *p++ = w->highest >> (8 * i);
+            }
+            for (int i = 0; i < 8; i++) {
+                *p++ = w->window >> (8 * i);
+            }
+            n++;
+        }
+        frame[3] = n;
+        err = send(ctx, frame, p - frame);
+        if (err == ESP_OK) {
+            done += n;
+        }
+    }
+    return err;
+}
+
+bool handoff_is_snapshot(const uint8_t *buf, size_t len)
+{
+    return len >= HANDOFF_HEADER_LEN && buf[0] == HANDOFF_MAGIC;
+}
+
+esp_err_t handoff_apply_snapshot(const uint8_t *buf, size_t len)
+{
+    if (!handoff_is_snapshot(buf, len) || buf[1] != HANDOFF_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    const uint8_t *p = buf + HANDOFF_HEADER_LEN;
+    const uint8_t *end = buf + len;
+    int count = buf[3];
+
+    if (buf[2] == HANDOFF_DNS) {
+        struct sockaddr_in addrs[DNS_CACHE_MAX_ADDRS];
+        if (count > DNS_CACHE_MAX_ADDRS || end - p != count * 6) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        for (int i = 0; i < count; i++, p += 6) {
+            memset(&addrs[i], 0, sizeof(addrs[i]));
+            addrs[i].sin_family = AF_INET;
+            memcpy(&addrs[i].sin_addr.s_addr, p, 4);
+            memcpy(&addrs[i].sin_port, p + 4, 2);
+        }
+        dns_cache_seed(addrs, count);
+        return ESP_OK;
+    }
+    if (buf[2] == HANDOFF_PATIENTS) {
+        char id[PATIENT_ID_LEN];
+        for (int i = 0; i < count; i++) {
+            if (p >= end || *p >= PATIENT_ID_LEN || end - p - 1 < *p) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            memcpy(id, p + 1, *p);
+            id[*p] = '\0';
+            patient_cache_store(id, PATIENT_EXISTS);
+            p += 1 + *p;
+        }
+        ESP_LOGI(TAG, "Took over %d known patient(s)", count);
+        return ESP_OK;
+    }
+    if (buf[2] == HANDOFF_DEDUP) {
+        dedup_entry_t w;
+        for (int i = 0; i < count; i++) {
+            if (p >= end) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            size_t id_len = *p++;
+            if (id_len >= DEDUP_ORIGIN_LEN || (size_t)(end - p) < id_len + 12) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            memcpy(w.origin, p, id_len);
+            w.origin[id_len] = '\0';
+            p += id_len;
+            w.highest = 0;
+            w.window = 0;
+            for (int b = 0; b < 4; b++) {
+                w.highest |= (uint32_t)*p++ << (8 * b);
+            }
+            for (int b = 0; b < 8; b++) {
+                w.window |= (uint64_t)*p++ << (8 * b);
+            }
+            dedup_merge(&w);
+        }
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_SUPPORTED; // kinds from newer firmware are skipped
+}
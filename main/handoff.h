@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "neolink.h"
+
+/* Root-switch handoff. When the mesh elects a new root, the yielding root sends its queued and
+ * spooled readings on as ordinary neo_wire frames, followed by snapshot frames that warm the new
+ * root's DNS and patient caches:
+ *   magic, version, kind, entry count
+ *   HANDOFF_DNS entries: [IPv4 address][port], both in network order
+ *   HANDOFF_PATIENTS entries: [len][patient ID], known patients only
+ *   HANDOFF_DEDUP entries: [len][node ID][highest sequence, 4 bytes][window, 8 bytes], little endian
+ * The magic differs from NEO_WIRE_MAGIC, so the receiving root tells the two apart by the first byte. */
+#define HANDOFF_MAGIC 0xA6
+#define HANDOFF_VERSION 1
+#define HANDOFF_HEADER_LEN 4
+
+typedef enum {
+    HANDOFF_DNS = 1,
+    HANDOFF_PATIENTS = 2,
+    HANDOFF_DEDUP = 3,
+} handoff_kind_t;
+
+typedef esp_err_t (*handoff_send_fn)(void *ctx, const uint8_t *frame, size_t len);
+
+/* Pack readings into as few frames as possible and send them. `sent` counts the readings that
+ * went out; on failure the rest are left to the caller. */
+esp_err_t handoff_send_readings(handoff_send_fn send, void *ctx, const mesh_message_t *msgs, size_t count,
+                                bool critical, size_t *sent);
+
+/* Send the cached API addresses, known patients and duplicate windows. `patients` counts the
+ * patients sent. */
+esp_err_t handoff_send_snapshot(handoff_send_fn send, void *ctx, uint32_t *patients);
+
+bool handoff_is_snapshot(const uint8_t *buf, size_t len);
+
+/* Load a snapshot frame into the local caches. */
+esp_err_t handoff_apply_snapshot(const uint8_t *buf, size_t len);
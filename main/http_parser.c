@@ -0,0 +1,227 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "http_parser.h"
+
+enum {
+    HTTP_STATE_STATUS,
+    HTTP_STATE_HEADER,
+    HTTP_STATE_BODY, //Content-Length bytes
+    HTTP_STATE_BODY_UNTIL_CLOSE,
+    HTTP_STATE_CHUNK_SIZE,
+    HTTP_STATE_CHUNK_DATA,
+    HTTP_STATE_CHUNK_END, //CRLF after the chunk data
+    HTTP_STATE_TRAILER,
+    HTTP_STATE_DONE,
+    HTTP_STATE_ERROR,
+};
+
+void http_parser_init(http_parser_t *parser, bool head)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->state = HTTP_STATE_STATUS;
+    parser->no_body = head;
+    parser->content_length = -1;
+}
+
+// Collect bytes up to the end of a line. Returns true once a whole line is in parser->line.
+static bool http_parser_line(http_parser_t *parser, const char *data, size_t len, size_t *pos)
+{
+    while (*pos < len) {
+        char c = data[(*pos)++];
+        if (c == '\n') {
+            if (parser->line_len > 0 && parser->line[parser->line_len - 1] == '\r') {
+                parser->line_len--;
+            }
+            parser->line[parser->line_len] = '\0';
+            return true;
+        }
+        if (parser->line_len < sizeof(parser->line) - 1) {
+            parser->line[parser->line_len++] = c;
+        }
+    }
+    return false;
+}
+
+// Does the comma separated list `value` contain `token`?
+static bool http_parser_has_token(const char *value, const char *token)
+{
+    size_t token_len = strlen(token);
+    while (*value != '\0') {
+        while (*value == ' ' || *value == ',') value++;
+        size_t len = strcspn(value, ", ");
+        if (len == token_len && strncasecmp(value, token, len) == 0) {
+            return true;
+        }
+        value += len;
+    }
+    return false;
+}
+
+static bool http_parser_status_line(http_parser_t *parser)
+{
+    const char *line = parser->line;
+    // HTTP/1.x NNN reason
+    if (strncmp(line, "HTTP/1.", 7) != 0 || !isdigit((unsigned char)line[7]) || line[8] != ' ' ||
+            !isdigit((unsigned char)line[9]) || !isdigit((unsigned char)line[10]) ||
+            !isdigit((unsigned char)line[11]) || (line[12] != ' ' && line[12] != '\0')) {
+        return false;
+    }
+    parser->status = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+    // HTTP/1.0 closes unless the server asks to keep the connection
+    parser->close = line[7] == '0';
+    return true;
+}
+
+static bool http_parser_header(http_parser_t *parser)
+{
+    char *line = parser->line;
+    char *value = strchr(line, ':');
+    if (value == NULL) {
+        return false;
+    }
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t') value++;
+    size_t len = strlen(value);
+    while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')) value[--len] = '\0';
+
+    if (strcasecmp(line, "Content-Length") == 0) {
+        char *end = NULL;
+        long long length = strtoll(value, &end, 10);
+        if (end == value || *end != '\0' || length < 0 ||
+                (parser->content_length >= 0 && parser->content_length != length)) {
+            return false;
+        }
+        parser->content_length = length;
+    } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+        // chunked is always the last transfer coding
+        parser->chunked = len >= 7 && strcasecmp(value + len - 7, "chunked") == 0;
+    } else if (strcasecmp(line, "Connection") == 0) {
+        if (http_parser_has_token(value, "close")) {
+            parser->close = true;
+        } else if (http_parser_has_token(value, "keep-alive")) {
+            parser->close = false;
+        }
+    }
+    return true;
+}
+
+// The empty line after the headers decides how the body is delimited
+static void http_parser_headers_done(http_parser_t *parser)
+{
+    if (parser->status >= 100 && parser->status < 200) {
+        // Interim response, the real one follows
+        bool head = parser->no_body;
+        http_parser_init(parser, head);
+    } else if (parser->no_body || parser->status == 204 || parser->status == 304) {
+        parser->state = HTTP_STATE_DONE;
+    } else if (parser->chunked) {
+        parser->state = HTTP_STATE_CHUNK_SIZE;
+    } else if (parser->content_length >= 0) {
+        parser->remaining = parser->content_length;
+        parser->state = parser->remaining > 0 ? HTTP_STATE_BODY : HTTP_STATE_DONE;
+    } else {
+        parser->close = true;
+        parser->state = HTTP_STATE_BODY_UNTIL_CLOSE;
+    }
+}
+
+static bool http_parser_chunk_size(http_parser_t *parser)
+{
+    uint64_t size = 0;
+    const char *p = parser->line;
+    if (!isxdigit((unsigned char)*p)) {
+        return false;
+    }
+    for (; isxdigit((unsigned char)*p); p++) {
+        if (size >> 60) {
+            return false;
+        }
+        size = size * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (tolower((unsigned char)*p) - 'a' + 10));
+    }
+    // Chunk extensions after ';' are ignored
+    if (*p != '\0' && *p != ';' && *p != ' ' && *p != '\t') {
+        return false;
+    }
+    parser->remaining = size;
+    parser->state = size > 0 ? HTTP_STATE_CHUNK_DATA : HTTP_STATE_TRAILER;
+    return true;
+}
+
+http_parse_result_t http_parser_feed(http_parser_t *parser, const char *data, size_t len, size_t *consumed)
+{
+    size_t pos = 0;
+    while (parser->state != HTTP_STATE_DONE && parser->state != HTTP_STATE_ERROR && pos < len) {
+        switch (parser->state) {
+        case HTTP_STATE_BODY:
+        case HTTP_STATE_CHUNK_DATA: {
+            // Skip body bytes without looking at them
+            size_t skip = len - pos < parser->remaining ? len - pos : (size_t)parser->remaining;
+            pos += skip;
+            parser->remaining -= skip;
+            if (parser->remaining == 0) {
+                parser->state = parser->state == HTTP_STATE_BODY ? HTTP_STATE_DONE : HTTP_STATE_CHUNK_END;
+            }
+            break;
+        }
+        case HTTP_STATE_BODY_UNTIL_CLOSE:
+            pos = len;
+            break;
+        default:
+            if (!http_parser_line(parser, data, len, &pos)) {
+                break;
+            }
+            bool ok = true;
+            bool empty = parser->line_len == 0;
+            switch (parser->state) {
+            case HTTP_STATE_STATUS:
+                ok = http_parser_status_line(parser);
+                parser->state = HTTP_STATE_HEADER;
+                break;
+            case HTTP_STATE_HEADER:
+                if (empty) {
+                    http_parser_headers_done(parser);
+                } else {
+                    ok = http_parser_header(parser);
+                }
+                break;
+            case HTTP_STATE_CHUNK_SIZE:
+                ok = http_parser_chunk_size(parser);
+                break;
+            case HTTP_STATE_CHUNK_END:
+                ok = empty;
+                parser->state = HTTP_STATE_CHUNK_SIZE;
+                break;
+            case HTTP_STATE_TRAILER:
+                if (empty) {
+                    parser->state = HTTP_STATE_DONE;
+                }
+                break;
+            }
+            parser->line_len = 0;
+            if (!ok) {
+                parser->state = HTTP_STATE_ERROR;
+            }
+            break;
+        }
+    }
+    *consumed = pos;
+    if (parser->state == HTTP_STATE_DONE) {
+        return HTTP_PARSE_DONE;
+    }
+    return parser->state == HTTP_STATE_ERROR ? HTTP_PARSE_ERROR : HTTP_PARSE_MORE;
+}
+
+http_parse_result_t http_parser_finish(http_parser_t *parser)
+{
+    if (parser->state == HTTP_STATE_BODY_UNTIL_CLOSE) {
+        parser->state = HTTP_STATE_DONE;
+    }
+    return parser->state == HTTP_STATE_DONE ? HTTP_PARSE_DONE : HTTP_PARSE_ERROR;
+}
+
+bool http_parser_keep_alive(const http_parser_t *parser)
+{
+    return parser->state == HTTP_STATE_DONE && !parser->close;
+}
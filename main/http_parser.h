@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Incremental HTTP/1.1 response parser. Bytes are fed as they arrive, in pieces of any size.
+ * It tracks the status line, the headers that decide where the response ends (Content-Length,
+ * Transfer-Encoding: chunked, Connection) and skips the body without copying it.
+ * Interim 1xx responses are skipped as well. */
+#define HTTP_PARSER_LINE_MAX 128 //longer header lines are truncated, which is harmless for the ones we read
+
+typedef enum {
+    HTTP_PARSE_MORE, //need more bytes
+    HTTP_PARSE_DONE, //a whole response was read
+    HTTP_PARSE_ERROR, //not a valid response, the connection cannot be reused
+} http_parse_result_t;
+
+typedef struct {
+    uint8_t state;
+    int status; //0 until the status line was read
+    bool no_body; //HEAD request, or a status that never has a body
+    bool chunked;
+    bool close; //the server will close the connection after this response
+    int64_t content_length; //-1 when not given
+    uint64_t remaining; //body or chunk bytes still to skip
+    char line[HTTP_PARSER_LINE_MAX];
+    size_t line_len;
+} http_parser_t;
+
+/* `head` tells the parser the request was a HEAD, whose response has headers only. */
+void http_parser_init(http_parser_t *parser, bool head);
+
+/* Parse up to `len` bytes. `consumed` is set to the bytes used; once the response is complete any
+ * bytes after it belong to the next one. */
+http_parse_result_t http_parser_feed(http_parser_t *parser, const char *data, size_t len, size_t *consumed);
+
+/* The peer closed the connection: DONE if that is how this response ends, ERROR if it was cut short. */
+http_parse_result_t http_parser_finish(http_parser_t *parser);
+
+/* Whether the connection can carry another request after a complete response. */
+bool http_parser_keep_alive(const http_parser_t *parser);
@@ -0,0 +1,336 @@
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "dns_cache.h"
+#include "http_parser.h"
+#include "metrics.h"
+#include "http_pool.h"
+
+typedef struct {
+    int sock; //-1 while not connected
+    bool busy;
+} http_conn_t;
+
+static const char *TAG = "neoHTTP";
+static http_conn_t pool[HTTP_POOL_MAX_SIZE];
+static int pool_size = 0;
+static const char *pool_host = NULL;
+static const char *pool_port = NULL;
+static SemaphoreHandle_t pool_lock = NULL;
+static SemaphoreHandle_t pool_free = NULL;
+static SemaphoreHandle_t pool_routine = NULL; //routine requests may hold all but the reserved connection
+static http_pool_stats_t stats = {0};
+
+esp_err_t http_pool_init(const char *host, const char *port, int size)
+{
+    if (host == NULL || port == NULL || size < 1 || size > HTTP_POOL_MAX_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (pool_lock != NULL) {
+        return ESP_OK; // already initialised
+    }
+    pool_lock = xSemaphoreCreateMutex();
+    pool_free = xSemaphoreCreateCounting(size, size);
+    int routine = size > 1 ? size - 1 : size;
+    pool_routine = xSemaphoreCreateCounting(routine, routine);
+    if (pool_lock == NULL || pool_free == NULL || pool_routine == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < HTTP_POOL_MAX_SIZE; i++) {
+        pool[i].sock = -1;
+        pool[i].busy = false;
+    }
+    pool_host = host;
+    pool_port = port;
+    pool_size = size;
+    ESP_LOGI(TAG, "Keep-alive pool for %s:%s, %d connection(s), %d reserved for critical traffic",
+             host, port, size, size - routine);
+    return ESP_OK;
+}
+
+static void http_pool_count(uint32_t *counter)
+{
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    (*counter)++;
+    xSemaphoreGive(pool_lock);
+}
+
+// Connect with HTTP_POOL_TIMEOUT_MS as the limit rather than the stack's own handshake timeout
+static int http_pool_connect_to(const struct sockaddr_in *addr, const struct timeval *timeout)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    int flags = fcntl(sock, F_GETFL, 0);
+    bool connected = fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+    if (connected && connect(sock, (const struct sockaddr *)addr, sizeof(*addr)) != 0) {
+        fd_set writable;
+        struct timeval wait = *timeout; // select() may change it
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        FD_ZERO(&writable);
+        FD_SET(sock, &writable);
+        connected = errno == EINPROGRESS && select(sock + 1, NULL, &writable, NULL, &wait) == 1 &&
+                    getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_len) == 0 && error == 0;
+    }
+    if (!connected || fcntl(sock, F_SETFL, flags) != 0) {
+        close(sock);
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, timeout, sizeof(*timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, timeout, sizeof(*timeout));
+    return sock;
+}
+
+static int http_pool_connect(void)
+{
+    struct sockaddr_in addrs[DNS_CACHE_MAX_ADDRS];
+    struct timeval timeout = {
+        .tv_sec = HTTP_POOL_TIMEOUT_MS / 1000,
+        .tv_usec = (HTTP_POOL_TIMEOUT_MS % 1000) * 1000,
+    };
+    int count = 0;
+    int sock = -1;
+    int64_t start = esp_timer_get_time();
+
+    if (dns_cache_resolve(addrs, DNS_CACHE_MAX_ADDRS, &count) != ESP_OK) {
+        return -1;
+    }
+    metrics_record_us(METRIC_DNS, esp_timer_get_time() - start);
+    start = esp_timer_get_time();
+
+    // Try connecting to the resolved addresses
+    for (int i = 0; i < count && sock < 0; i++) {
+        sock = http_pool_connect_to(&addrs[i], &timeout);
+    }
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to connect to %s", pool_host);
+        dns_cache_refresh(); // the cached addresses may be out of date
+        return -1;
+    }
+    // Failed attempts end in timeouts, they would only blur the handshake times
+    metrics_record_us(METRIC_CONNECT, esp_timer_get_time() - start);
+    http_pool_count(&stats.handshakes);
+    return sock;
+}
+
+// An idle keep-alive socket is only usable if the server has neither closed it nor sent anything
+static bool http_pool_is_stale(int sock)
+{
+    char c;
+    int n = recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0) {
+        return errno != EAGAIN && errno != EWOULDBLOCK;
+    }
+    return true;
+}
+
+static http_conn_t *http_pool_take(void)
+{
+    http_conn_t *conn = NULL;
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    // Prefer a slot that already holds an open connection
+    for (int i = 0; i < pool_size; i++) {
+        if (!pool[i].busy && (conn == NULL || (conn->sock < 0 && pool[i].sock >= 0))) {
+            conn = &pool[i];
+        }
+    }
+    conn->busy = true;
+    xSemaphoreGive(pool_lock);
+    return conn;
+}
+
+static void http_pool_give(http_conn_t *conn, bool critical)
+{
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    conn->busy = false;
+    xSemaphoreGive(pool_lock);
+    xSemaphoreGive(pool_free);
+    if (!critical) {
+        xSemaphoreGive(pool_routine);
+    }
+}
+
+static int http_pool_send_all(int sock, const http_request_t *request)
+{
+    struct iovec iov[HTTP_REQUEST_MAX_IOV];
+    struct iovec *next = iov;
+    int count = request->iov_count;
+
+    memcpy(iov, request->iov, count * sizeof(iov[0]));
+    while (count > 0) {
+        ssize_t n = writev(sock, next, count);
+        if (n <= 0) {
+            return -1;
+        }
+        // Partial write: skip what went out and send the rest
+        while (count > 0 && (size_t)n >= next->iov_len) {
+            n -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0) {
+            next->iov_base = (char *)next->iov_base + n;
+            next->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* Read one response, discarding the body. Returns 1 when complete, 0 if the peer closed before
+ * sending anything and -1 on any other failure. */
+static int http_pool_read_response(int sock, bool head, int *status, bool *keep_alive)
+{
+    http_parser_t parser;
+    char buf[256];
+    bool received = false;
+
+    http_parser_init(&parser, head);
+    while (true) {
+        int len = recv(sock, buf, sizeof(buf), 0);
+        if (len <= 0) {
+            // Without a length the body ends when the server closes the connection
+            if (len == 0 && received && http_parser_finish(&parser) == HTTP_PARSE_DONE) {
+                break;
+            }
+            return received ? -1 : 0;
+        }
+        received = true;
+        size_t used = 0;
+        http_parse_result_t res = http_parser_feed(&parser, buf, len, &used);
+        if (res == HTTP_PARSE_ERROR) {
+            ESP_LOGE(TAG, "Malformed response from %s", pool_host);
+            return -1;
+        }
+        if (res == HTTP_PARSE_DONE) {
+            // Bytes after the response were never asked for, the connection is out of step
+            parser.close = parser.close || used < (size_t)len;
+            break;
+        }
+    }
+    *status = parser.status;
+    *keep_alive = http_parser_keep_alive(&parser);
+    return 1;
+}
+
+esp_err_t http_pool_request(const http_request_t *request, bool critical, int *status)
+{
+    if (pool_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (request == NULL || request->iov_count < 1 || status == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    bool head = strncmp(request->head, "HEAD ", 5) == 0;
+    http_pool_count(&stats.requests);
+    if (!critical && xSemaphoreTake(pool_routine, pdMS_TO_TICKS(HTTP_POOL_TIMEOUT_MS)) != pdTRUE) {
+        http_pool_count(&stats.failures);
+        metrics_count(METRIC_HTTP_FAILED);
+        return ESP_ERR_TIMEOUT;
+    }
+    if (xSemaphoreTake(pool_free, pdMS_TO_TICKS(HTTP_POOL_TIMEOUT_MS)) != pdTRUE) {
+        if (!critical) {
+            xSemaphoreGive(pool_routine);
+        }
+        http_pool_count(&stats.failures);
+        metrics_count(METRIC_HTTP_FAILED);
+        return ESP_ERR_TIMEOUT;
+    }
+    http_conn_t *conn = http_pool_take();
+    esp_err_t err = ESP_FAIL;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = conn->sock >= 0;
+        if (reused && http_pool_is_stale(conn->sock)) {
+            close(conn->sock);
+            conn->sock = -1;
+            reused = false;
+        }
+        if (conn->sock < 0) {
+            conn->sock = http_pool_connect();
+            if (conn->sock < 0) {
+                break;
+            }
+        } else {
+            http_pool_count(&stats.reused);
+        }
+
+        bool keep_alive = false;
+        int rc = -1;
+        int64_t start = esp_timer_get_time();
+        if (http_pool_send_all(conn->sock, request) == 0) {
+            metrics_record_us(METRIC_SEND, esp_timer_get_time() - start);
+            start = esp_timer_get_time();
+            rc = http_pool_read_response(conn->sock, head, status, &keep_alive);
+            metrics_record_us(METRIC_RESPONSE, esp_timer_get_time() - start);
+        } else if (reused) {
+            rc = 0; // the server dropped the idle connection before we could use it
+        }
+        if (rc == 1) {
+            if (!keep_alive) {
+                close(conn->sock);
+                conn->sock = -1;
+            }
+            err = ESP_OK;
+            if (*status >= 500) {
+                metrics_count(METRIC_HTTP_5XX);
+            } else if (*status >= 400) {
+                metrics_count(METRIC_HTTP_4XX);
+            }
+            break;
+        }
+        close(conn->sock);
+        conn->sock = -1;
+        // Only retry when nothing came back on a reused socket, so a request is never applied twice
+        if (rc != 0 || !reused) {
+            ESP_LOGE(TAG, "Request to %s failed", pool_host);
+            break;
+        }
+        ESP_LOGW(TAG, "Kept-alive connection closed by %s, reconnecting", pool_host);
+        http_pool_count(&stats.reconnects);
+        metrics_count(METRIC_RETRIES);
+    }
+
+    if (err != ESP_OK) {
+        http_pool_count(&stats.failures);
+        metrics_count(METRIC_HTTP_FAILED);
+    }
+    http_pool_give(conn, critical);
+    return err;
+}
+
+void http_pool_get_stats(http_pool_stats_t *out)
+{
+    if (pool_lock == NULL) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(pool_lock);
+}
+
+void http_pool_close_all(void)
+{
+    if (pool_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    for (int i = 0; i < pool_size; i++) {
+        if (!pool[i].busy && pool[i].sock >= 0) {
+            close(pool[i].sock);
+            pool[i].sock = -1;
+        }
+    }
+    xSemaphoreGive(pool_lock);
+}
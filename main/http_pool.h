@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "http_request.h"
+
+#define HTTP_POOL_MAX_SIZE 4 //upper bound for the configurable pool size
+#define HTTP_POOL_TIMEOUT_MS 5000 //connect, send and receive timeout on pooled sockets
+
+typedef struct {
+    uint32_t requests; //requests handed to the pool
+    uint32_t reused; //requests sent on an already open connection
+    uint32_t handshakes; //TCP connects performed
+    uint32_t reconnects; //retries after the server closed a kept-alive connection
+    uint32_t failures; //requests that could not be completed
+} http_pool_stats_t;
+
+/* Set up a pool of up to `size` keep-alive connections to host:port. Connections are opened lazily. */
+esp_err_t http_pool_init(const char *host, const char *port, int size);
+
+/* Send a request with one writev() and read the whole response, see http_parser.h.
+ * Only the status is kept; the body is drained so the connection can be reused.
+ * If a kept-alive connection turns out to be closed by the server it is reopened and the request
+ * is sent once more.
+ * With two or more connections one is kept for `critical` requests, so an alert never waits behind
+ * routine uploads. */
+esp_err_t http_pool_request(const http_request_t *request, bool critical, int *status);
+
+void http_pool_get_stats(http_pool_stats_t *stats);
+
+/* Close every idle connection, e.g. when this node stops being root. */
+void http_pool_close_all(void);
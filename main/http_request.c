@@ -0,0 +1,92 @@
+#include <stdbool.h>
+#include <string.h>
+#include "http_request.h"
+
+// Append `len` bytes to the head. Returns false once the head is full.
+static bool http_request_put(http_request_t *request, const char *data, size_t len)
+{
+    if (request->head_len > sizeof(request->head) || len > sizeof(request->head) - request->head_len) {
+        request->head_len = sizeof(request->head) + 1; // marks the head as overflowed for later puts
+        return false;
+    }
+    memcpy(request->head + request->head_len, data, len);
+    request->head_len += len;
+    return true;
+}
+
+static bool http_request_put_str(http_request_t *request, const char *str)
+{
+    return http_request_put(request, str, strlen(str));
+}
+
+// Unreserved characters go as they are, anything else as %XX
+static bool http_request_put_segment(http_request_t *request, const char *segment)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (const char *p = segment; *p != '\0'; p++) {
+        unsigned char c = (unsigned char)*p;
+        bool unreserved = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+                          c == '-' || c == '.' || c == '_' || c == '~';
+        char escaped[3] = { '%', hex[c >> 4], hex[c & 15] };
+        if (!(unreserved ? http_request_put(request, p, 1) : http_request_put(request, escaped, 3))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool http_request_put_uint(http_request_t *request, size_t value)
+{
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[sizeof(digits) - 1 - n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    return http_request_put(request, digits + sizeof(digits) - n, n);
+}
+
+esp_err_t http_request_build(http_request_t *request, const char *method, const char *host, const char *path,
+                             const char *id, const char *body, size_t body_len, const char *encoding)
+{
+    request->head_len = 0;
+    request->iov_count = 0;
+    http_request_put_str(request, method);
+    http_request_put(request, " ", 1);
+    http_request_put_str(request, path);
+    if (id != NULL) {
+        http_request_put(request, "/", 1);
+        http_request_put_segment(request, id);
+    }
+    http_request_put_str(request, " HTTP/1.1\r\nHost: ");
+    http_request_put_str(request, host);
+    if (body != NULL) {
+        http_request_put_str(request, "\r\nContent-Type: application/json\r\nContent-Length: ");
+        http_request_put_uint(request, body_len);
+        if (encoding != NULL) {
+            http_request_put_str(request, "\r\nContent-Encoding: ");
+            http_request_put_str(request, encoding);
+        }
+    }
+    if (!http_request_put(request, "\r\n\r\n", 4)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    request->iov[0].iov_base = request->head;
+    request->iov[0].iov_len = request->head_len;
+    request->iov_count = 1;
+    if (body != NULL && body_len > 0) {
+        request->iov[1].iov_base = (void *)body;
+        request->iov[1].iov_len = body_len;
+        request->iov_count = 2;
+    }
+    return ESP_OK;
+}
+
+size_t http_request_len(const http_request_t *request)
+{
+    size_t len = 0;
+    for (int i = 0; i < request->iov_count; i++) {
+        len += request->iov[i].iov_len;
+    }
+    return len;
+}
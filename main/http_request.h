@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include "esp_err.h"
+
+/* An HTTP/1.1 request as a scatter-gather list: the request line and headers are formatted into
+ * `head`, the body is referenced where it already is. http_pool_request() hands both to one
+ * writev(), so the body is never copied. */
+#define HTTP_REQUEST_HEAD_MAX 256 //request line and headers
+#define HTTP_REQUEST_MAX_IOV 2 //head and body
+
+typedef struct {
+    char head[HTTP_REQUEST_HEAD_MAX];
+    size_t head_len;
+    struct iovec iov[HTTP_REQUEST_MAX_IOV];
+    int iov_count;
+} http_request_t;
+
+/* Build "<method> <path>[/<id>]" with a Host header and, when `body` is given, a JSON body,
+ * labelled with `encoding` as its Content-Encoding unless that is NULL. `id` is percent-encoded as
+ * one path segment. The body must stay valid until the request is sent.
+ * Returns ESP_ERR_INVALID_SIZE if the head does not fit, the request is unusable then. */
+esp_err_t http_request_build(http_request_t *request, const char *method, const char *host, const char *path,
+                             const char *id, const char *body, size_t body_len, const char *encoding);
+
+/* Total bytes on the wire. */
+size_t http_request_len(const http_request_t *request);
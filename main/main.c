@@ -4,11 +4,19 @@
 #include "esp_mac.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_mesh.h"
 #include "esp_mesh_internal.h"
 #include "nvs_flash.h"
-#include <sys/socket.h>
-#include <netdb.h>
+#include "driver/temperature_sensor.h"
+#include "budget.h"
+#include "duty.h"
+#include "flow.h"
+#include "metrics.h"
+#include "neo_wire.h"
+#include "producer.h"
+#include "root.h"
+#include "trace.h"
 
 #define MESH_ROUTER_SSID "urs" //router name here
 #define MESH_ROUTER_PASSWD "aveganedo" //router password here
@@ -20,16 +28,59 @@
 #define MESH_AP_CONNECTIONS 6
 #define MESH_NON_MESH_AP_CONNECTIONS 0
 
-#define MESH_ENABLE_PS 1
-#define MESH_PS_DEV_DUTY 10 //device duty cycle
-#define MESH_PS_NWK_DUTY 10 //network duty cycle
+#define MESH_ENABLE_PS 1 //0 keeps the radio on
+#define MESH_PS_DEV_DUTY 10 //device duty cycle at start, adjusted by the controller in duty.c
+#define MESH_PS_DEV_DUTY_MIN 10 //device duty cycle bounds
+#define MESH_PS_DEV_DUTY_MAX 80
+#define MESH_PS_NWK_DUTY_MIN 10 //network duty cycle bounds, set by the root
+#define MESH_PS_NWK_DUTY_MAX 40
 #define MESH_PS_DEV_DUTY_TYPE 1 //MESH_PS_DEV_DUTY_TYPE_DEMAND 0 and REQUEST 1
+#define MESH_PS_PER_DESCENDANT 5 //device duty cycle floor raised per node routing through this one
+#define MESH_PS_PERIOD_MS 5000 //how often the load is sampled
+#define MESH_PS_BUSY_FPS 2.0f //frames per second that count as busy
+#define MESH_PS_IDLE_FPS 0.5f //frames per second that count as idle
+#define MESH_PS_BUSY_BACKLOG 8 //frames or readings waiting that count as busy
+#define MESH_PS_IDLE_PERIODS 6 //idle periods in a row before the duty cycle is lowered
+#define MESH_PS_STEP_DOWN 10 //duty cycle taken off per idle step
 #define MESH_AP_AUTHMODE WIFI_AUTH_WPA2_PSK //AP authentication mode
 //WIFI_AUTH_OPEN, WIFI_AUTH_WEP, WIFI_AUTH_WPA_PSK, WIFI_AUTH_WPA2_PSK, WIFI_AUTH_WPA_WPA2_PSK
 
 #define MESH_PS_NWK_DUTY_DURATION -1 //network duty cycle duration
 #define MESH_PS_NWK_DUTY_RULE MESH_PS_NETWORK_DUTY_APPLIED_ENTIRE //network duty cycle rule MESH_PS_NETWORK_DUTY_APPLIED_UPLINK
 
+#define HTTP_PORT "80" //API port
+#define DNS_CACHE_TTL_MS (10 * 60 * 1000) //how long a resolved API address is used before it is refreshed
+#define HTTP_POOL_SIZE 3 //keep-alive connections kept open to the API, one is kept for alerts (max HTTP_POOL_MAX_SIZE)
+#define UPLOAD_TASKS 2 //uploader tasks draining the routine queue, keep < HTTP_POOL_SIZE
+#define UPLOAD_PIN_CORES true //pin uploader task i to core i % portNUM_PROCESSORS
+#define UPLOAD_BULK_PATH "/patients/bulk" //bulk endpoint, NULL to upload every reading on its own
+#define UPLOAD_BATCH_ITEMS 16 //readings per bulk request (max BATCH_MAX_ITEMS)
+#define UPLOAD_BATCH_BYTES 2048 //JSON bytes per bulk request (max BATCH_MAX_BYTES)
+#define UPLOAD_BATCH_DELAY_MS 500 //longest a reading waits for its batch to fill
+#define UPLOAD_STORE_AND_FORWARD true //spool unsent readings to the "spool" partition
+#define UPLOAD_ENCODING DEFLATE_GZIP //bulk body Content-Encoding: DEFLATE_GZIP, DEFLATE_ZLIB or DEFLATE_NONE
+#define UPLOAD_COMPRESS_MIN 512 //bulk bodies shorter than this are sent uncompressed
+#define PATIENT_CACHE_PERSIST true //keep known patients in NVS across reboots
+#define ROOT_RECV_POLL_MS 500 //the root's receive loop checks for a root switch at least this often
+#define NODE_ROLE_CHECK_MS 5000 //a non-root node checks whether it became root at least this often
+#define NEOLINK_STACK 4096 //frames are received into static buffers, see rx_buf
+#define FLOW_HIGH_PCT 75 //receive or upload queue fill at which the root asks sensors to slow down
+#define FLOW_LOW_PCT 25 //fill at which they may speed up again
+#define FLOW_MAX_STRETCH 8 //sensors wait at most this many times their usual latency (max FLOW_STRETCH_MAX)
+#define FLOW_STEP_MS 2000 //the root changes its hint at most this often
+#define FLOW_HINT_TTL_S 60 //sensors drop a hint that was not repeated for this long
+
+#define SENSOR_PATIENT_ID "PAT-001" //patient this sensor array is attached to
+#define SENSOR_SAMPLE_MS 1000 //sampling period
+#define SENSOR_WINDOW_MS 10000 //readings are aggregated into min/max/mean over this window
+#define SENSOR_DEADBAND 0.2f //windows changing less than this from the last sent mean are not sent
+#define SENSOR_HEARTBEAT_MS 60000 //send a window at least this often even if nothing changed
+#define SENSOR_MAX_LATENCY_MS 20000 //longest an aggregated reading waits for more to share its frame
+#define SENSOR_DECIMALS 1 //decimal places sent
+#define SENSOR_ALERT_LOW 0.0f //samples below this are sent at once as critical alerts
+#define SENSOR_ALERT_HIGH 60.0f //samples above this are sent at once as critical alerts
+#define SENSOR_ACK_TIMEOUT_MS 3000 //resend a frame the root has not acknowledged after this long, 0 to not ask
+
 // Variables -=-=-=-=-=-=-=-=-=- 
 
 static const char *MESH_TAG = "neoMesh"; //TAG for logs, shows up in terminal
@@ -37,191 +88,307 @@ static const char *TAG = "neoMeshAPI"; //TAG for logs, shows up in terminal
 static const char *SelfIdentity = "STU-001-NEO";
 
 static const uint8_t MESH_ID[6] = { 0x77, 0x77, 0x77, 0x77, 0x77, 0x77};
+static const mesh_addr_t MESH_BROADCAST = { .addr = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff } };
+static int xon_qsize = FLOW_XON_DEFAULT; //mesh receive queue size, chosen at boot
 static bool is_running = true;
 static bool is_mesh_connected = false;
 static mesh_addr_t mesh_parent_addr;
 static int mesh_layer = -1; //mesh layer
 static esp_netif_t *netif_sta = NULL;
+static TaskHandle_t neolink_task = NULL;
+static mesh_addr_t handoff_to; //root candidate that asked this root to yield
+static volatile bool handoff_requested = false;
 
 // neoLink Setup -=-=-=-=-=-=-=-=-=- 
 
-typedef struct {
-    char sensor_id[32];
-    char patient_id[32];
-    char sensor_data[128];
-} mesh_message_t;
+static uint8_t rx_buf[NEO_WIRE_MAX_FRAME];
+static size_t rx_held = 0; //frame left in rx_buf for the root loop, see neolink_node()
+static temperature_sensor_handle_t temp_sensor = NULL;
 
-void neolink(void *arg) {
+// Stand-in for the sensor array: the chip's own temperature sensor
+static esp_err_t sensor_sample(void *ctx, float *value)
+{
+    if (temp_sensor == NULL) {
+        temperature_sensor_config_t config = TEMPERATURE_SENSOR_CONFIG_DEFAULT(10, 50);
+        esp_err_t err = temperature_sensor_install(&config, &temp_sensor);
+        if (err == ESP_OK) {
+            err = temperature_sensor_enable(temp_sensor);
+        }
+        if (err != ESP_OK) {
+            temp_sensor = NULL;
+            return err;
+        }
+    }
+    return temperature_sensor_get_celsius(temp_sensor, value);
+}
+
+/* Frames go up the mesh to the root; if this node has become root it queues them itself.
+ * Routine frames must not stall sampling when the mesh queue is full, the producer retries them later.
+ * Alerts wait for room. */
+static esp_err_t sensor_send(void *ctx, const uint8_t *frame, size_t len, bool critical)
+{
+    duty_count_frames(1);
+    if (esp_mesh_is_root()) {
+        root_ingest_result_t result;
+        esp_err_t err = root_ingest(frame, len, &result);
+        if (err == ESP_OK && result.ack) {
+            producer_ack(result.origin.ptr, result.origin.len, result.seq);
+        }
+        return err;
+    }
+    mesh_data_t data = {
+        .data = (uint8_t *)frame,
+        .size = len,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    return esp_mesh_send(NULL, &data, critical ? 0 : MESH_DATA_NONBLOCK, NULL, 0);
+}
+
+/* Handoff frames go to the root candidate while this node is still root, and up to whichever node
+ * is root once it is not. */
+static esp_err_t handoff_send(void *ctx, const uint8_t *frame, size_t len)
+{
+    mesh_data_t data = {
+        .data = (uint8_t *)frame,
+        .size = len,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    if (esp_mesh_is_root()) {
+        return esp_mesh_send(&handoff_to, &data, MESH_DATA_P2P, NULL, 0);
+    }
+    return esp_mesh_send(NULL, &data, 0, NULL, 0);
+}
+
+// Readings the root has yet to upload count towards the power save controller's backlog
+static uint32_t duty_root_backlog(void *ctx)
+{
+    msg_queue_stats_t routine, critical;
+    root_get_queue_stats(UPLOAD_LANE_ROUTINE, &routine);
+    root_get_queue_stats(UPLOAD_LANE_CRITICAL, &critical);
+    return routine.depth + critical.depth;
+}
+
+// Wake the neoLink task early, e.g. when this node's role changes
+static void neolink_wake(void)
+{
+    if (neolink_task != NULL) {
+        xTaskNotifyGive(neolink_task);
+    }
+}
+
+static void neolink_ack(const mesh_addr_t *to, const root_ingest_result_t *result)
+{
+    uint8_t ack[NEO_WIRE_ACK_MAX];
+    mesh_data_t data = {
+        .data = ack,
+        .size = neo_wire_ack_encode(ack, result->origin, result->seq),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    // Best effort: a lost acknowledgement only costs a resend, which the duplicate filter drops
+    esp_mesh_send(to, &data, MESH_DATA_P2P | MESH_DATA_NONBLOCK, NULL, 0);
+}
+
+// Tell the sensors to slow down or speed up when the root's queues call for it
+static void neolink_flow(void)
+{
+    mesh_rx_pending_t pending = {0};
+    msg_queue_stats_t queue;
+    neo_wire_hint_t hint;
+    uint8_t buf[NEO_WIRE_HINT_LEN];
+
+    esp_mesh_get_rx_pending(&pending);
+    root_get_queue_stats(UPLOAD_LANE_ROUTINE, &queue);
+    if (!flow_update(pending.toSelf, xon_qsize, queue.depth, queue.capacity, esp_timer_get_time(), &hint)) {
+        return;
+    }
+    mesh_data_t data = {
+        .data = buf,
+        .size = neo_wire_hint_encode(buf, &hint),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    producer_hint(hint.stretch, hint.ttl_s * 1000); // this node's own sensor, if it has one running
+    esp_mesh_send(&MESH_BROADCAST, &data, MESH_DATA_P2P | MESH_DATA_NONBLOCK, NULL, 0);
+}
+
+static void neolink_yield(void)
+{
+    root_handoff_stats_t handoff;
+    esp_err_t err = root_yield(handoff_send, NULL, &handoff);
+    if (err != ESP_OK) {
+        ESP_LOGW("Root", "Handoff incomplete: %s", esp_err_to_name(err));
+    }
+}
+
+/* Root node only drains the mesh here, uploads happen in the uploader tasks. When another node
+ * takes over, pending readings and warm caches are handed to it and frames still arriving here
+ * are forwarded, so nothing is dropped during the switch. */
+static void neolink_root(const root_config_t *config, const flow_config_t *flow)
+{
     mesh_data_t data;
     mesh_addr_t from;
-    mesh_message_t msg = {0};
     int flag = 0;
-    const char *host = "api.neobit.gg";
-    const char *path = "/patients";
+    root_ingest_result_t result;
+    bool yielded = false;
 
-    data.data = (uint8_t *)&msg;
-    data.size = sizeof(mesh_message_t);
+    data.data = rx_buf;
     data.proto = MESH_PROTO_BIN;
     data.tos = MESH_TOS_P2P;
 
+    ESP_ERROR_CHECK(root_start(config));
+    ESP_ERROR_CHECK(flow_init(flow));
+    if (rx_held > 0) {
+        root_ingest(rx_buf, rx_held, &result); // a handoff frame that arrived before the switch completed
+        rx_held = 0;
+    }
+    while (esp_mesh_is_root()) {
+        if (handoff_requested && !yielded) {
+            ESP_LOGI("Root", "Yielding root to "MACSTR, MAC2STR(handoff_to.addr));
+            neolink_yield();
+            yielded = true;
+        }
+        if (!yielded) {
+            neolink_flow();
+        }
+        data.size = sizeof(rx_buf);
+        esp_err_t err = esp_mesh_recv(&from, &data, ROOT_RECV_POLL_MS, &flag, NULL, 0);
+        if (err == ESP_ERR_MESH_TIMEOUT) {
+            continue;
+        }
+        if (err != ESP_OK) {
+            metrics_count(METRIC_RECV_ERRORS);
+            continue;
+        }
+        duty_count_frames(1);
+        if (yielded) {
+            handoff_send(NULL, data.data, data.size);
+            continue;
+        }
+        err = root_ingest(data.data, data.size, &result);
+        if (err != ESP_OK) {
+            ESP_LOGW("Root", "Dropped malformed frame (%d bytes) from "MACSTR": %s",
+                     data.size, MAC2STR(from.addr), esp_err_to_name(err));
+            continue;
+        }
+        trace_record(TRACE_FRAME_IN, from.addr, data.size, result.queued, result.duplicates);
+        if (result.ack) {
+            neolink_ack(&from, &result);
+        }
+    }
+    // Lost the role without being asked, e.g. a new vote: the queue still goes to the new root
+    if (!yielded) {
+        neolink_yield();
+    }
+    // Frames that reached this node while it was root follow the rest
+    data.size = sizeof(rx_buf);
+    while (esp_mesh_recv(&from, &data, 0, &flag, NULL, 0) == ESP_OK) {
+        handoff_send(NULL, data.data, data.size);
+        data.size = sizeof(rx_buf);
+    }
+    handoff_requested = false;
+}
+
+/* A non-root node only expects acknowledgements and flow control hints, which go to the producer.
+ * Anything else is a previous root handing over while this node is about to take the role: it is
+ * held for neolink_root(), and the rest stays queued in the mesh stack. Returns true if a frame
+ * was held. */
+static bool neolink_node(void)
+{
+    mesh_data_t data;
+    mesh_addr_t from;
+    int flag = 0;
+    neo_str_t origin;
+    uint32_t seq = 0;
+    neo_wire_hint_t hint;
+    int64_t until = esp_timer_get_time() + NODE_ROLE_CHECK_MS * 1000LL;
+
+    if (rx_held > 0) {
+        // The switch did not happen after all, the current root gets the frame
+        handoff_send(NULL, rx_buf, rx_held);
+        rx_held = 0;
+    }
+    data.data = rx_buf;
+    while (!esp_mesh_is_root() && esp_timer_get_time() < until) {
+        data.size = sizeof(rx_buf);
+        if (esp_mesh_recv(&from, &data, ROOT_RECV_POLL_MS, &flag, NULL, 0) == ESP_OK) {
+            duty_count_frames(1);
+            if (neo_wire_hint_parse(data.data, data.size, &hint)) {
+                producer_hint(hint.stretch, hint.ttl_s * 1000);
+            } else if (neo_wire_ack_parse(data.data, data.size, &origin, &seq)) {
+                producer_ack(origin.ptr, origin.len, seq);
+            } else {
+                rx_held = data.size;
+                return true;
+            }
+        }
+        if (ulTaskNotifyTake(pdTRUE, 0) > 0) {
+            break; // role change signalled
+        }
+    }
+    return false;
+}
+
+void neolink(void *arg) {
+    const root_config_t config = {
+        .host = "api.neobit.gg",
+        .port = HTTP_PORT,
+        .dns_ttl_ms = DNS_CACHE_TTL_MS,
+        .pool_size = HTTP_POOL_SIZE,
+        .persist_patients = PATIENT_CACHE_PERSIST,
+        .upload = {
+            .path = "/patients",
+            .bulk_path = UPLOAD_BULK_PATH,
+            .tasks = UPLOAD_TASKS,
+            .pin_cores = UPLOAD_PIN_CORES,
+            .batch_items = UPLOAD_BATCH_ITEMS,
+            .batch_bytes = UPLOAD_BATCH_BYTES,
+            .batch_delay_ms = UPLOAD_BATCH_DELAY_MS,
+            .store_and_forward = UPLOAD_STORE_AND_FORWARD,
+            .encoding = UPLOAD_ENCODING,
+            .compress_min = UPLOAD_COMPRESS_MIN,
+        },
+    };
+    const flow_config_t flow_config = {
+        .high_pct = FLOW_HIGH_PCT,
+        .low_pct = FLOW_LOW_PCT,
+        .max_stretch = FLOW_MAX_STRETCH,
+        .step_ms = FLOW_STEP_MS,
+        .ttl_s = FLOW_HINT_TTL_S,
+    };
+    const producer_config_t sensor_config = {
+        .sensor_id = SelfIdentity,
+        .patient_id = SENSOR_PATIENT_ID,
+        .sample_ms = SENSOR_SAMPLE_MS,
+        .window_ms = SENSOR_WINDOW_MS,
+        .deadband = SENSOR_DEADBAND,
+        .heartbeat_ms = SENSOR_HEARTBEAT_MS,
+        .max_latency_ms = SENSOR_MAX_LATENCY_MS,
+        .decimals = SENSOR_DECIMALS,
+        .extremes = true,
+        .alert_low = SENSOR_ALERT_LOW,
+        .alert_high = SENSOR_ALERT_HIGH,
+        .ack_timeout_ms = SENSOR_ACK_TIMEOUT_MS,
+        .sample = sensor_sample,
+        .send = sensor_send,
+    };
+
     is_running = true;
     while (is_running) {
         if (esp_mesh_is_root()) {
-            // Root node receives and logs the messages
-            while (true) {
-                if (esp_mesh_recv(&from, &data, portMAX_DELAY, &flag, NULL, 0) == ESP_OK) {
-                    mesh_message_t *received = (mesh_message_t *)data.data;
-
-                    ESP_LOGI("Root", "%s | measured %s for %s",
-                             received->sensor_id,
-                             received->sensor_data,
-                             received->patient_id);
-
-                    // HTTP Functionality
-                    const char *port = "80"; // For HTTP
-                    char request[512];
-                    char post_data[256];
-                    char patch_data[256];
-                    struct addrinfo hints = {0};
-                    struct addrinfo *res = NULL, *p = NULL;
-                    int sock = -1;
-
-                    // Build the JSON payload for POST
-                    snprintf(post_data, sizeof(post_data),
-                             "{\"patient_id\":\"%s\",\"sensor_id\":\"%s\",\"sensor_data\":\"%s\"}",
-                             received->patient_id, received->sensor_id, received->sensor_data);
-
-                    // Build the JSON payload for PATCH
-                    snprintf(patch_data, sizeof(patch_data),
-                             "{\"patient_id\":\"%s\",\"sensor_id\":\"%s\",\"sensor_data\":\"%s\"}",
-                             received->patient_id, received->sensor_id, received->sensor_data);
-
-                    // Resolve hostname to IP address
-                    hints.ai_family = AF_INET;
-                    hints.ai_socktype = SOCK_STREAM;
-
-                    if (getaddrinfo(host, port, &hints, &res) != 0 || res == NULL) {
-                        ESP_LOGE("HTTP", "DNS lookup failed for host %s", host);
-                        continue;
-                    }
-
-                    // Try connecting to the resolved addresses
-                    for (p = res; p != NULL; p = p->ai_next) {
-                        sock = socket(p->ai_family, p->ai_socktype, 0);
-                        if (sock < 0) continue;
-                        if (connect(sock, p->ai_addr, p->ai_addrlen) == 0) break; // Success
-                        close(sock);
-                        sock = -1;
-                    }
-
-                    if (sock < 0) {
-                        ESP_LOGE("HTTP", "Unable to connect to %s", host);
-                        freeaddrinfo(res);
-                        continue;
-                    }
-
-                    // Build HTTP GET request to check if patient exists
-                    snprintf(request, sizeof(request),
-                             "GET %s/%s HTTP/1.1\r\n"
-                             "Host: %s\r\n"
-                             "Connection: close\r\n\r\n",
-                             path, received->patient_id, host);
-
-                    // Send the GET request
-                    if (write(sock, request, strlen(request)) < 0) {
-                        ESP_LOGE("HTTP", "Socket write failed");
-                        close(sock);
-                        freeaddrinfo(res);
-                        continue;
-                    }
-
-                    // Read the GET response
-                    char response[512];
-                    int len = read(sock, response, sizeof(response) - 1);
-                    if (len > 0) {
-                        response[len] = '\0'; // Null-terminate the response
-                        ESP_LOGI("HTTP", "GET Response:\n%s", response);
-                    } else {
-                        ESP_LOGE("HTTP", "Failed to read GET response");
-                    }
-
-                    // Determine if patient exists based on GET response
-                    bool patient_exists = (strstr(response, "200 OK") != NULL);
-
-                    // Clean up
-                    close(sock);
-                    freeaddrinfo(res);
-
-                    // Reconnect for POST/PATCH request
-                    if (getaddrinfo(host, port, &hints, &res) != 0 || res == NULL) {
-                        ESP_LOGE("HTTP", "DNS lookup failed for host %s", host);
-                        continue;
-                    }
-
-                    for (p = res; p != NULL; p = p->ai_next) {
-                        sock = socket(p->ai_family, p->ai_socktype, 0);
-                        if (sock < 0) continue;
-                        if (connect(sock, p->ai_addr, p->ai_addrlen) == 0) break; // Success
-                        close(sock);
-                        sock = -1;
-                    }
-
-                    if (sock < 0) {
-                        ESP_LOGE("HTTP", "Unable to connect to %s", host);
-                        freeaddrinfo(res);
-                        continue;
-                    }
-
-                    // Build HTTP POST or PATCH request based on patient existence
-                    if (patient_exists) {
-                        snprintf(request, sizeof(request),
-                                 "PATCH %s/%s HTTP/1.1\r\n"
-                                 "Host: %s\r\n"
-                                 "Content-Type: application/json\r\n"
-                                 "Content-Length: %d\r\n"
-                                 "Connection: close\r\n\r\n"
-                                 "%s",
-                                 path, received->patient_id, host, strlen(patch_data), patch_data);
-                    } else {
-                        snprintf(request, sizeof(request),
-                                 "POST %s HTTP/1.1\r\n"
-                                 "Host: %s\r\n"
-                                 "Content-Type: application/json\r\n"
-                                 "Content-Length: %d\r\n"
-                                 "Connection: close\r\n\r\n"
-                                 "%s",
-                                 path, host, strlen(post_data), post_data);
-                    }
-
-                    // Send the POST/PATCH request
-                    if (write(sock, request, strlen(request)) < 0) {
-                        ESP_LOGE("HTTP", "Socket write failed");
-                        close(sock);
-                        freeaddrinfo(res);
-                        continue;
-                    }
-
-                    // Read and log the response
-                    len = read(sock, response, sizeof(response) - 1);
-                    if (len > 0) {
-                        response[len] = '\0'; // Null-terminate the response
-                        ESP_LOGI("HTTP", "Response:\n%s", response);
-                    } else {
-                        ESP_LOGE("HTTP", "Failed to read response");
-                    }
-
-                    // Clean up
-                    close(sock);
-                    freeaddrinfo(res);
-
-                    // Confirmation log
-                    ESP_LOGI("Root", "Confirmed receipt from %s", received->sensor_id);
-                }
-            }
+            neolink_root(&config, &flow_config);
         } else {
-            ESP_LOGE(SelfIdentity, "Currently NOT a ROOT node. Please reboot the Sensor Array!");
+            if (producer_start(&sensor_config) != ESP_OK) {
+                ESP_LOGE(SelfIdentity, "Sensor pipeline could not be started");
+            }
+            if (!neolink_node()) {
+                continue;
+            }
         }
-        vTaskDelay(pdMS_TO_TICKS(5000)); // Send every 5 seconds
+        // Check the node's role again in 5 seconds, or as soon as a root switch is signalled
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(NODE_ROLE_CHECK_MS));
     }
     vTaskDelete(NULL);
 }
@@ -231,7 +398,8 @@ esp_err_t esp_mesh_comm_p2p_start(void)
     static bool is_started = false;
     if (!is_started) {
         is_started = true;
-        xTaskCreate(neolink, "neoLink 2-Way Communication Protocol", 4096, NULL, 5, NULL);
+        xTaskCreate(neolink, "neoLink 2-Way Communication Protocol", NEOLINK_STACK, NULL, 5, &neolink_task);
+        budget_watch(neolink_task, NEOLINK_STACK);
     }
     return ESP_OK;
 }
@@ -248,62 +416,49 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
     switch (event_id) {
     case MESH_EVENT_STARTED: {
         esp_mesh_get_id(&id);
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_MESH_STARTED>ID:"MACSTR"", MAC2STR(id.addr));
+        trace_record(TRACE_MESH_STARTED, id.addr, 0, 0, 0);
         is_mesh_connected = false;
         mesh_layer = esp_mesh_get_layer();
     }
     break;
     case MESH_EVENT_STOPPED: {
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_STOPPED>");
+        trace_record(TRACE_MESH_STOPPED, NULL, 0, 0, 0);
         is_mesh_connected = false;
         mesh_layer = esp_mesh_get_layer();
     }
     break;
     case MESH_EVENT_CHILD_CONNECTED: {
         mesh_event_child_connected_t *child_connected = (mesh_event_child_connected_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_CHILD_CONNECTED>aid:%d, "MACSTR"",
-                 child_connected->aid,
-                 MAC2STR(child_connected->mac));
+        trace_record(TRACE_CHILD_CONNECTED, child_connected->mac, child_connected->aid, 0, 0);
     }
     break;
     case MESH_EVENT_CHILD_DISCONNECTED: {
         mesh_event_child_disconnected_t *child_disconnected = (mesh_event_child_disconnected_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_CHILD_DISCONNECTED>aid:%d, "MACSTR"",
-                 child_disconnected->aid,
-                 MAC2STR(child_disconnected->mac));
+        trace_record(TRACE_CHILD_DISCONNECTED, child_disconnected->mac, child_disconnected->aid, 0, 0);
+        duty_child_gone(child_disconnected->aid);
     }
     break;
     case MESH_EVENT_ROUTING_TABLE_ADD: {
         mesh_event_routing_table_change_t *routing_table = (mesh_event_routing_table_change_t *)event_data;
-        ESP_LOGW(MESH_TAG, "<MESH_EVENT_ROUTING_TABLE_ADD>add %d, new:%d, layer:%d",
-                 routing_table->rt_size_change,
-                 routing_table->rt_size_new, mesh_layer);
+        trace_record(TRACE_ROUTING_ADD, NULL, routing_table->rt_size_change, routing_table->rt_size_new, mesh_layer);
     }
     break;
     case MESH_EVENT_ROUTING_TABLE_REMOVE: {
         mesh_event_routing_table_change_t *routing_table = (mesh_event_routing_table_change_t *)event_data;
-        ESP_LOGW(MESH_TAG, "<MESH_EVENT_ROUTING_TABLE_REMOVE>remove %d, new:%d, layer:%d",
-                 routing_table->rt_size_change,
-                 routing_table->rt_size_new, mesh_layer);
+        trace_record(TRACE_ROUTING_REMOVE, NULL, routing_table->rt_size_change, routing_table->rt_size_new, mesh_layer);
     }
     break;
     case MESH_EVENT_NO_PARENT_FOUND: {
         mesh_event_no_parent_found_t *no_parent = (mesh_event_no_parent_found_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_NO_PARENT_FOUND>scan times:%d",
-                 no_parent->scan_times);
+        trace_record(TRACE_NO_PARENT, NULL, no_parent->scan_times, 0, 0);
     }
     /* TODO handler for the failure */
     break;
     case MESH_EVENT_PARENT_CONNECTED: {
         mesh_event_connected_t *connected = (mesh_event_connected_t *)event_data;
-        esp_mesh_get_id(&id);
         mesh_layer = connected->self_layer;
         memcpy(&mesh_parent_addr.addr, connected->connected.bssid, 6);
-        ESP_LOGI(MESH_TAG,
-                 "<MESH_EVENT_PARENT_CONNECTED>layer:%d-->%d, parent:"MACSTR"%s, ID:"MACSTR", duty:%d",
-                 last_layer, mesh_layer, MAC2STR(mesh_parent_addr.addr),
-                 esp_mesh_is_root() ? "<ROOT>" :
-                 (mesh_layer == 2) ? "<layer2>" : "", MAC2STR(id.addr), connected->duty);
+        trace_record(TRACE_PARENT_CONNECTED, mesh_parent_addr.addr, last_layer, mesh_layer, connected->duty);
         last_layer = mesh_layer;
         is_mesh_connected = true;
         if (esp_mesh_is_root()) {
@@ -311,13 +466,12 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
             esp_netif_dhcpc_start(netif_sta);
         }
         esp_mesh_comm_p2p_start();
+        neolink_wake();
     }
     break;
     case MESH_EVENT_PARENT_DISCONNECTED: {
         mesh_event_disconnected_t *disconnected = (mesh_event_disconnected_t *)event_data;
-        ESP_LOGI(MESH_TAG,
-                 "<MESH_EVENT_PARENT_DISCONNECTED>reason:%d",
-                 disconnected->reason);
+        trace_record(TRACE_PARENT_DISCONNECTED, NULL, disconnected->reason, 0, 0);
         is_mesh_connected = false;
         mesh_layer = esp_mesh_get_layer();
     }
@@ -325,113 +479,99 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
     case MESH_EVENT_LAYER_CHANGE: {
         mesh_event_layer_change_t *layer_change = (mesh_event_layer_change_t *)event_data;
         mesh_layer = layer_change->new_layer;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_LAYER_CHANGE>layer:%d-->%d%s",
-                 last_layer, mesh_layer,
-                 esp_mesh_is_root() ? "<ROOT>" :
-                 (mesh_layer == 2) ? "<layer2>" : "");
+        trace_record(TRACE_LAYER_CHANGE, NULL, last_layer, mesh_layer, 0);
         last_layer = mesh_layer;
     }
     break;
     case MESH_EVENT_ROOT_ADDRESS: {
         mesh_event_root_address_t *root_addr = (mesh_event_root_address_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_ROOT_ADDRESS>root address:"MACSTR"",
-                 MAC2STR(root_addr->addr));
+        trace_record(TRACE_ROOT_ADDRESS, root_addr->addr, 0, 0, 0);
     }
     break;
     case MESH_EVENT_VOTE_STARTED: {
         mesh_event_vote_started_t *vote_started = (mesh_event_vote_started_t *)event_data;
-        ESP_LOGI(MESH_TAG,
-                 "<MESH_EVENT_VOTE_STARTED>attempts:%d, reason:%d, rc_addr:"MACSTR"",
-                 vote_started->attempts,
-                 vote_started->reason,
-                 MAC2STR(vote_started->rc_addr.addr));
+        trace_record(TRACE_VOTE_STARTED, vote_started->rc_addr.addr, vote_started->attempts, vote_started->reason, 0);
     }
     break;
     case MESH_EVENT_VOTE_STOPPED: {
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_VOTE_STOPPED>");
+        trace_record(TRACE_VOTE_STOPPED, NULL, 0, 0, 0);
         break;
     }
     case MESH_EVENT_ROOT_SWITCH_REQ: {
         mesh_event_root_switch_req_t *switch_req = (mesh_event_root_switch_req_t *)event_data;
-        ESP_LOGI(MESH_TAG,
-                 "<MESH_EVENT_ROOT_SWITCH_REQ>reason:%d, rc_addr:"MACSTR"",
-                 switch_req->reason,
-                 MAC2STR( switch_req->rc_addr.addr));
+        trace_record(TRACE_ROOT_SWITCH_REQ, switch_req->rc_addr.addr, switch_req->reason, 0, 0);
+        // This root is asked to yield: hand pending readings and caches to the candidate
+        handoff_to = switch_req->rc_addr;
+        handoff_requested = true;
+        neolink_wake();
     }
     break;
     case MESH_EVENT_ROOT_SWITCH_ACK: {
         /* new root */
         mesh_layer = esp_mesh_get_layer();
         esp_mesh_get_parent_bssid(&mesh_parent_addr);
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_ROOT_SWITCH_ACK>layer:%d, parent:"MACSTR"", mesh_layer, MAC2STR(mesh_parent_addr.addr));
+        trace_record(TRACE_ROOT_SWITCH_ACK, mesh_parent_addr.addr, mesh_layer, 0, 0);
+        neolink_wake(); // start the root data path without waiting for the next role check
     }
     break;
     case MESH_EVENT_TODS_STATE: {
         mesh_event_toDS_state_t *toDs_state = (mesh_event_toDS_state_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_TODS_REACHABLE>state:%d", *toDs_state);
+        trace_record(TRACE_TODS_STATE, NULL, *toDs_state, 0, 0);
     }
     break;
     case MESH_EVENT_ROOT_FIXED: {
         mesh_event_root_fixed_t *root_fixed = (mesh_event_root_fixed_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_ROOT_FIXED>%s",
-                 root_fixed->is_fixed ? "fixed" : "not fixed");
+        trace_record(TRACE_ROOT_FIXED, NULL, root_fixed->is_fixed, 0, 0);
     }
     break;
     case MESH_EVENT_ROOT_ASKED_YIELD: {
         mesh_event_root_conflict_t *root_conflict = (mesh_event_root_conflict_t *)event_data;
-        ESP_LOGI(MESH_TAG,
-                 "<MESH_EVENT_ROOT_ASKED_YIELD>"MACSTR", rssi:%d, capacity:%d",
-                 MAC2STR(root_conflict->addr),
-                 root_conflict->rssi,
-                 root_conflict->capacity);
+        trace_record(TRACE_ROOT_ASKED_YIELD, root_conflict->addr, root_conflict->rssi, root_conflict->capacity, 0);
     }
     break;
     case MESH_EVENT_CHANNEL_SWITCH: {
         mesh_event_channel_switch_t *channel_switch = (mesh_event_channel_switch_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_CHANNEL_SWITCH>new channel:%d", channel_switch->channel);
+        trace_record(TRACE_CHANNEL_SWITCH, NULL, channel_switch->channel, 0, 0);
     }
     break;
     case MESH_EVENT_SCAN_DONE: {
         mesh_event_scan_done_t *scan_done = (mesh_event_scan_done_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_SCAN_DONE>number:%d",
-                 scan_done->number);
+        trace_record(TRACE_SCAN_DONE, NULL, scan_done->number, 0, 0);
     }
     break;
     case MESH_EVENT_NETWORK_STATE: {
         mesh_event_network_state_t *network_state = (mesh_event_network_state_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_NETWORK_STATE>is_rootless:%d",
-                 network_state->is_rootless);
+        trace_record(TRACE_NETWORK_STATE, NULL, network_state->is_rootless, 0, 0);
     }
     break;
     case MESH_EVENT_STOP_RECONNECTION: {
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_STOP_RECONNECTION>");
+        trace_record(TRACE_STOP_RECONNECTION, NULL, 0, 0, 0);
     }
     break;
     case MESH_EVENT_FIND_NETWORK: {
         mesh_event_find_network_t *find_network = (mesh_event_find_network_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_FIND_NETWORK>new channel:%d, router BSSID:"MACSTR"",
-                 find_network->channel, MAC2STR(find_network->router_bssid));
+        trace_record(TRACE_FIND_NETWORK, find_network->router_bssid, find_network->channel, 0, 0);
     }
     break;
     case MESH_EVENT_ROUTER_SWITCH: {
         mesh_event_router_switch_t *router_switch = (mesh_event_router_switch_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_ROUTER_SWITCH>new router:%s, channel:%d, "MACSTR"",
-                 router_switch->ssid, router_switch->channel, MAC2STR(router_switch->bssid));
+        trace_record(TRACE_ROUTER_SWITCH, router_switch->bssid, router_switch->channel, 0, 0);
     }
     break;
     case MESH_EVENT_PS_PARENT_DUTY: {
         mesh_event_ps_duty_t *ps_duty = (mesh_event_ps_duty_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_PS_PARENT_DUTY>duty:%d", ps_duty->duty);
+        trace_record(TRACE_PS_PARENT_DUTY, NULL, ps_duty->duty, 0, 0);
+        duty_parent_duty(ps_duty->duty);
     }
     break;
     case MESH_EVENT_PS_CHILD_DUTY: {
         mesh_event_ps_duty_t *ps_duty = (mesh_event_ps_duty_t *)event_data;
-        ESP_LOGI(MESH_TAG, "<MESH_EVENT_PS_CHILD_DUTY>cidx:%d, "MACSTR", duty:%d", ps_duty->child_connected.aid-1,
-                MAC2STR(ps_duty->child_connected.mac), ps_duty->duty);
+        trace_record(TRACE_PS_CHILD_DUTY, ps_duty->child_connected.mac, ps_duty->child_connected.aid, ps_duty->duty, 0);
+        duty_child_duty(ps_duty->child_connected.aid, ps_duty->duty);
     }
     break;
     default:
-        ESP_LOGI(MESH_TAG, "unknown id:%" PRId32 "", event_id);
+        trace_record(TRACE_MESH_UNKNOWN, NULL, event_id, 0, 0);
         break;
     }
 }
@@ -447,6 +587,10 @@ void ip_event_handler(void *arg, esp_event_base_t event_base,
 void app_main(void)
 {
     ESP_ERROR_CHECK(nvs_flash_init());
+    /*  mesh events and the upload path log through the trace ring, see trace.h */
+    ESP_ERROR_CHECK(trace_start());
+    /*  heap and task stack watch, see budget.h */
+    ESP_ERROR_CHECK(budget_start());
     /*  tcpip initialization */
     ESP_ERROR_CHECK(esp_netif_init());
     /*  event initialization */
@@ -467,8 +611,10 @@ void app_main(void)
     /*  set mesh max layer according to the topology */
     ESP_ERROR_CHECK(esp_mesh_set_max_layer(MESH_MAX_LAYER));
     ESP_ERROR_CHECK(esp_mesh_set_vote_percentage(1));
-    ESP_ERROR_CHECK(esp_mesh_set_xon_qsize(128));
-#ifdef MESH_ENABLE_PS
+    /* receive queue sized from the load seen last time and the free heap, see flow.h */
+    xon_qsize = flow_xon_qsize(esp_get_free_heap_size());
+    ESP_ERROR_CHECK(esp_mesh_set_xon_qsize(xon_qsize));
+#if MESH_ENABLE_PS
     /* Enable mesh PS function */
     ESP_ERROR_CHECK(esp_mesh_enable_ps());
     /* better to increase the associate expired time, if a small duty cycle is set. */
@@ -498,11 +644,27 @@ void app_main(void)
     ESP_ERROR_CHECK(esp_mesh_set_config(&cfg));
     /* mesh start */
     ESP_ERROR_CHECK(esp_mesh_start());
-#ifdef CONFIG_MESH_ENABLE_PS
-    /* set the device active duty cycle. (default:10, MESH_PS_DEVICE_DUTY_REQUEST) */
-    ESP_ERROR_CHECK(esp_mesh_set_active_duty_cycle(MESH_PS_DEV_DUTY, MESH_PS_DEV_DUTY_TYPE));
-    /* set the network active duty cycle. (default:10, -1, MESH_PS_NETWORK_DUTY_APPLIED_ENTIRE) */
-    ESP_ERROR_CHECK(esp_mesh_set_network_duty_cycle(MESH_PS_NWK_DUTY, MESH_PS_NWK_DUTY_DURATION, MESH_PS_NWK_DUTY_RULE));
+#if MESH_ENABLE_PS
+    /* device and network duty cycles follow the load, see duty.h */
+    const duty_config_t duty_config = {
+        .dev_min = MESH_PS_DEV_DUTY_MIN,
+        .dev_max = MESH_PS_DEV_DUTY_MAX,
+        .dev_start = MESH_PS_DEV_DUTY,
+        .dev_type = MESH_PS_DEV_DUTY_TYPE,
+        .nwk_min = MESH_PS_NWK_DUTY_MIN,
+        .nwk_max = MESH_PS_NWK_DUTY_MAX,
+        .nwk_duration = MESH_PS_NWK_DUTY_DURATION,
+        .nwk_rule = MESH_PS_NWK_DUTY_RULE,
+        .per_descendant = MESH_PS_PER_DESCENDANT,
+        .period_ms = MESH_PS_PERIOD_MS,
+        .busy_fps = MESH_PS_BUSY_FPS,
+        .idle_fps = MESH_PS_IDLE_FPS,
+        .busy_backlog = MESH_PS_BUSY_BACKLOG,
+        .idle_periods = MESH_PS_IDLE_PERIODS,
+        .step_down = MESH_PS_STEP_DOWN,
+        .backlog = duty_root_backlog,
+    };
+    ESP_ERROR_CHECK(duty_start(&duty_config));
 #endif
     ESP_LOGI(MESH_TAG, "neoMesh started successfully, heap:%" PRId32 ", %s<%d>%s, ps:%d",  esp_get_minimum_free_heap_size(),
              esp_mesh_is_root_fixed() ? "root fixed" : "root not fixed",
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_rom_sys.h"
+#include "metrics.h"
+
+static metric_histogram_t histograms[METRIC_STAGES];
+static uint32_t counters[METRIC_COUNTERS];
+static portMUX_TYPE metrics_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *stage_names[METRIC_STAGES] = {
+    [METRIC_INGEST] = "ingest",
+    [METRIC_QUEUE] = "queue",
+    [METRIC_BATCH] = "batch",
+    [METRIC_DNS] = "dns",
+    [METRIC_CONNECT] = "connect",
+    [METRIC_SEND] = "send",
+    [METRIC_RESPONSE] = "resp",
+    [METRIC_GET] = "get",
+    [METRIC_WRITE] = "write",
+    [METRIC_BULK] = "bulk",
+    [METRIC_SPOOL] = "spool",
+    [METRIC_DEFLATE] = "deflate",
+    [METRIC_LANE_CRITICAL] = "lane_crit",
+    [METRIC_LANE_ROUTINE] = "lane_routine",
+};
+
+static const char *counter_names[METRIC_COUNTERS] = {
+    [METRIC_BAD_FRAMES] = "bad_frames",
+    [METRIC_RECV_ERRORS] = "recv_err",
+    [METRIC_HTTP_FAILED] = "http_fail",
+    [METRIC_HTTP_4XX] = "4xx",
+    [METRIC_HTTP_5XX] = "5xx",
+    [METRIC_RETRIES] = "retries",
+    [METRIC_OVERFLOW_SPOOLED] = "overflow_spooled",
+    [METRIC_DUPLICATES] = "duplicates",
+    [METRIC_DUTY_UP] = "duty_up",
+    [METRIC_DUTY_DOWN] = "duty_down",
+};
+
+// Log-linear buckets: values below 4 us get their own bucket, above that each power of two is
+// split in four, so a bucket is never more than 25% wide
+static int metrics_bucket(uint32_t us)
+{
+    if (us < 4) {
+        return us;
+    }
+    int msb = 31 - __builtin_clz(us);
+    int bucket = (msb - 1) * 4 + ((us >> (msb - 2)) & 3);
+    return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1;
+}
+
+static uint32_t metrics_bucket_upper(int bucket)
+{
+    if (bucket < 4) {
+        return bucket + 1;
+    }
+    int shift = bucket / 4 - 1;
+    return (uint32_t)(4 + bucket % 4 + 1) << shift;
+}
+
+void metrics_record_us(metric_stage_t stage, int64_t us)
+{
+    uint32_t value = us < 0 ? 0 : us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    int bucket = metrics_bucket(value);
+    metric_histogram_t *h = &histograms[stage];
+    portENTER_CRITICAL(&metrics_lock);
+    h->count++;
+    h->sum_us += value;
+    h->buckets[bucket]++;
+    if (value > h->max_us) {
+        h->max_us = value;
+    }
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+void metrics_record(metric_stage_t stage, uint32_t start)
+{
+    // Unsigned difference survives one wrap of the counter (about 17 s at 240 MHz)
+    uint32_t cycles = metrics_stamp() - start;
+    metrics_record_us(stage, cycles / esp_rom_get_cpu_ticks_per_us());
+}
+
+void metrics_count(metric_counter_t counter)
+{
+    portENTER_CRITICAL(&metrics_lock);
+    counters[counter]++;
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+void metrics_get_histogram(metric_stage_t stage, metric_histogram_t *out)
+{
+    portENTER_CRITICAL(&metrics_lock);
+    *out = histograms[stage];
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+uint32_t metrics_get_counter(metric_counter_t counter)
+{
+    portENTER_CRITICAL(&metrics_lock);
+    uint32_t value = counters[counter];
+    portEXIT_CRITICAL(&metrics_lock);
+    return value;
+}
+
+uint32_t metrics_percentile(const metric_histogram_t *h, int pct)
+{
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t rank = ((uint64_t)h->count * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_BUCKETS - 1; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint32_t upper = metrics_bucket_upper(i);
+            return upper < h->max_us ? upper : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
+int metrics_format(char *buf, size_t size)
+{
+    metric_histogram_t h;
+    size_t len = 0;
+    int n = 0;
+
+    buf[0] = '\0';
+    for (int s = 0; s < METRIC_STAGES; s++) {
+        metrics_get_histogram(s, &h);
+        if (h.count == 0) {
+            continue;
+        }
+        n = snprintf(buf + len, len < size ? size - len : 0, "%s%s:%" PRIu32 "/%" PRIu32 "/%" PRIu32 "/%" PRIu32,
+                     len > 0 ? " " : "", stage_names[s], h.count,
+                     metrics_percentile(&h, 50), metrics_percentile(&h, 99), h.max_us);
+        len += n;
+    }
+    for (int c = 0; c < METRIC_COUNTERS; c++) {
+        n = snprintf(buf + len, len < size ? size - len : 0, "%s%s=%" PRIu32,
+                     len > 0 ? " " : "", counter_names[c], metrics_get_counter(c));
+        len += n;
+    }
+    return (int)len;
+}
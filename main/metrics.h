@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_cpu.h"
+
+/* Per-stage latency histograms and error counters for the root data path.
+ * Recording is a bucket increment under a spinlock; nothing is formatted until someone asks.
+ * Short stages that never block are timed with the CPU cycle counter. Each core has its own, and a
+ * task that is not pinned can resume on the other core after blocking, so anything that may wait
+ * (sockets, flash, locks) or crosses tasks is timed with esp_timer and recorded in microseconds. */
+#define METRICS_BUCKETS 96 //four per power of two of microseconds up to 16 s, the last one is open ended
+
+typedef enum {
+    METRIC_INGEST, //decode a mesh frame and queue its readings
+    METRIC_QUEUE, //reading waiting in the upload queue
+    METRIC_BATCH, //oldest reading waiting for its batch to be sent
+    METRIC_DNS, //address lookup when opening a connection
+    METRIC_CONNECT, //TCP handshake
+    METRIC_SEND, //writing a request to the socket
+    METRIC_RESPONSE, //from the request being sent to the response being read
+    METRIC_GET, //patient lookup, whole request
+    METRIC_WRITE, //single reading POST or PATCH, whole request
+    METRIC_BULK, //bulk POST, whole request
+    METRIC_SPOOL, //encoding and writing a spool record
+    METRIC_DEFLATE, //compressing a bulk body
+    METRIC_LANE_CRITICAL, //critical reading from mesh ingest to the API's acknowledgement
+    METRIC_LANE_ROUTINE, //routine reading from mesh ingest to the API's acknowledgement
+    METRIC_STAGES,
+} metric_stage_t;
+
+typedef enum {
+    METRIC_BAD_FRAMES, //mesh frames that could not be decoded
+    METRIC_RECV_ERRORS, //esp_mesh_recv failures
+    METRIC_HTTP_FAILED, //requests without a response
+    METRIC_HTTP_4XX,
+    METRIC_HTTP_5XX,
+    METRIC_RETRIES, //requests sent again after a closed connection or a stale patient cache entry
+    METRIC_OVERFLOW_SPOOLED, //readings spooled at ingest because their queue was full
+    METRIC_DUPLICATES, //sequenced frames dropped because they were seen before
+    METRIC_DUTY_UP, //power save duty cycle raised, see duty.h
+    METRIC_DUTY_DOWN, //power save duty cycle lowered
+    METRIC_COUNTERS,
+} metric_counter_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[METRICS_BUCKETS];
+} metric_histogram_t;
+
+static inline uint32_t metrics_stamp(void)
+{
+    return esp_cpu_get_cycle_count();
+}
+
+/* Record the time since `start`, taken with metrics_stamp() on the same task with no blocking call
+ * in between. */
+void metrics_record(metric_stage_t stage, uint32_t start);
+void metrics_record_us(metric_stage_t stage, int64_t us);
+void metrics_count(metric_counter_t counter);
+
+void metrics_get_histogram(metric_stage_t stage, metric_histogram_t *histogram);
+uint32_t metrics_get_counter(metric_counter_t counter);
+
+/* Upper bound of the bucket holding the `pct` percentile, 0 without samples. */
+uint32_t metrics_percentile(const metric_histogram_t *histogram, int pct);
+
+/* One line: stage:count/p50/p99/max in microseconds for every stage with samples, then the
+ * counters. Returns the length as snprintf does. */
+int metrics_format(char *buf, size_t size);
@@ -0,0 +1,72 @@
+#include <string.h>
+#include "esp_timer.h"
+#include "msg_queue.h"
+
+esp_err_t msg_queue_init(msg_queue_t *queue, mesh_message_t *slots, int64_t *pushed_us, size_t capacity)
+{
+    if (queue == NULL || slots == NULL || pushed_us == NULL || capacity == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(queue, 0, sizeof(*queue));
+    queue->slots = slots;
+    queue->pushed_us = pushed_us;
+    queue->capacity = capacity;
+    queue->lock = xSemaphoreCreateMutex();
+    queue->items = xSemaphoreCreateCounting(capacity, 0);
+    return queue->lock != NULL && queue->items != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+bool msg_queue_push(msg_queue_t *queue, const mesh_message_t *msg)
+{
+    bool stored = false;
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(queue->lock, portMAX_DELAY);
+    if (queue->count < queue->capacity) {
+        size_t tail = (queue->head + queue->count) % queue->capacity;
+        memcpy(&queue->slots[tail], msg, sizeof(*msg));
+        queue->pushed_us[tail] = now;
+        queue->count++;
+        queue->pushed++;
+        if (queue->count > queue->high_water) {
+            queue->high_water = queue->count;
+        }
+        stored = true;
+    } else {
+        queue->dropped++;
+    }
+    xSemaphoreGive(queue->lock);
+    if (stored) {
+        xSemaphoreGive(queue->items);
+    }
+    return stored;
+}
+
+bool msg_queue_pop(msg_queue_t *queue, mesh_message_t *msg, int64_t *waited_us, TickType_t wait)
+{
+    if (xSemaphoreTake(queue->items, wait) != pdTRUE) {
+        return false;
+    }
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(queue->lock, portMAX_DELAY);
+    memcpy(msg, &queue->slots[queue->head], sizeof(*msg));
+    if (waited_us != NULL) {
+        *waited_us = now - queue->pushed_us[queue->head];
+    }
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    queue->popped++;
+    xSemaphoreGive(queue->lock);
+    return true;
+}
+
+void msg_queue_get_stats(msg_queue_t *queue, msg_queue_stats_t *stats)
+{
+    xSemaphoreTake(queue->lock, portMAX_DELAY);
+    stats->depth = queue->count;
+    stats->capacity = queue->capacity;
+    stats->high_water = queue->high_water;
+    stats->pushed = queue->pushed;
+    stats->popped = queue->popped;
+    stats->dropped = queue->dropped;
+    xSemaphoreGive(queue->lock);
+}
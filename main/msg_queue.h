@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "neolink.h"
+
+/* Bounded ring of mesh messages between the mesh receive task and the uploader tasks.
+ * Pushing never waits for room: when the ring is full the new message is dropped and counted.
+ * A message is a few hundred bytes, so the ring is guarded by a mutex rather than a spinlock:
+ * copying one in or out never holds off interrupts. */
+typedef struct {
+    mesh_message_t *slots;
+    int64_t *pushed_us; //push time per slot, tells how long a message waited
+    size_t capacity;
+    size_t head; //next slot to pop
+    size_t count;
+    size_t high_water;
+    uint32_t pushed;
+    uint32_t popped;
+    uint32_t dropped;
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t items; //counts messages ready to pop
+} msg_queue_t;
+
+typedef struct {
+    uint32_t depth;
+    uint32_t capacity;
+    uint32_t high_water;
+    uint32_t pushed;
+    uint32_t popped;
+    uint32_t dropped;
+} msg_queue_stats_t;
+
+/* `slots` and `pushed_us` both hold `capacity` entries. */
+esp_err_t msg_queue_init(msg_queue_t *queue, mesh_message_t *slots, int64_t *pushed_us, size_t capacity);
+bool msg_queue_push(msg_queue_t *queue, const mesh_message_t *msg);
+/* `waited_us` (may be NULL) receives how long the message spent in the queue. */
+bool msg_queue_pop(msg_queue_t *queue, mesh_message_t *msg, int64_t *waited_us, TickType_t wait);
+void msg_queue_get_stats(msg_queue_t *queue, msg_queue_stats_t *stats);
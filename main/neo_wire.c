@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "neo_wire.h"
+
+static size_t varint_len(uint32_t v)
+{
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static uint8_t *varint_put(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static bool varint_get(neo_wire_reader_t *r, uint32_t *v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (r->pos >= r->len) {
+            return false;
+        }
+        uint8_t b = r->buf[r->pos++];
+        *v |= (uint32_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static size_t value_len(const neo_value_t *value)
+{
+    switch (value->type) {
+    case NEO_VALUE_INT:
+        return varint_len(zigzag(value->i));
+    case NEO_VALUE_DECIMAL:
+        return varint_len(zigzag(value->dec.mantissa)) + 1;
+    case NEO_VALUE_FLOAT:
+        return sizeof(float);
+    default:
+        return 1 + value->text.len;
+    }
+}
+
+void neo_wire_writer_init(neo_wire_writer_t *writer, uint8_t *buf, size_t cap)
+{
+    writer->buf = buf;
+    writer->cap = cap;
+    writer->encoded = NEO_WIRE_HEADER_LEN;
+    writer->string_count = 0;
+    writer->reading_count = 0;
+    writer->flags = 0;
+    writer->origin = 0;
+    writer->seq = 0;
+}
+
+// Index of `s` in the string table, adding it if needed. *cost grows by the bytes a new entry takes.
+static int neo_wire_intern(neo_wire_writer_t *writer, const char *s, size_t *cost)
+{
+    size_t len = strnlen(s, UINT8_MAX);
+    for (int i = 0; i < writer->string_count; i++) {
+        if (writer->strings[i].len == len && memcmp(writer->strings[i].ptr, s, len) == 0) {
+            return i;
+        }
+    }
+    if (writer->string_count >= NEO_WIRE_MAX_STRINGS) {
+        return -1;
+    }
+    writer->strings[writer->string_count].ptr = s;
+    writer->strings[writer->string_count].len = len;
+    *cost += 1 + len;
+    return writer->string_count++;
+}
+
+esp_err_t neo_wire_add(neo_wire_writer_t *writer, const char *sensor_id, const char *patient_id,
+                       const neo_value_t *value)
+{
+    if (writer->reading_count >= NEO_WIRE_MAX_READINGS) {
+        return ESP_ERR_NO_MEM;
+    }
+    uint8_t strings = writer->string_count;
+    size_t cost = 3 + value_len(value);
+    int sensor = neo_wire_intern(writer, sensor_id, &cost);
+    int patient = neo_wire_intern(writer, patient_id, &cost);
+    if (sensor < 0 || patient < 0 || writer->encoded + cost > writer->cap) {
+        writer->string_count = strings; // forget IDs interned for this reading
+        return ESP_ERR_NO_MEM;
+    }
+    writer->readings[writer->reading_count].sensor = sensor;
+    writer->readings[writer->reading_count].patient = patient;
+    writer->readings[writer->reading_count].value = *value;
+    writer->reading_count++;
+    writer->encoded += cost;
+    return ESP_OK;
+}
+
+esp_err_t neo_wire_set_sequence(neo_wire_writer_t *writer, const char *origin, uint32_t seq)
+{
+    if (writer->flags & NEO_WIRE_FLAG_SEQUENCED) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint8_t strings = writer->string_count;
+    size_t cost = 1 + varint_len(seq);
+    int index = neo_wire_intern(writer, origin, &cost);
+    if (index < 0 || writer->encoded + cost > writer->cap) {
+        writer->string_count = strings;
+        return ESP_ERR_NO_MEM;
+    }
+    writer->origin = index;
+    writer->seq = seq;
+    writer->flags |= NEO_WIRE_FLAG_SEQUENCED;
+    writer->encoded += cost;
+    return ESP_OK;
+}
+
+esp_err_t neo_wire_finish(neo_wire_writer_t *writer, size_t *len)
+{
+    uint8_t *p = writer->buf;
+    *p++ = NEO_WIRE_MAGIC;
+    *p++ = NEO_WIRE_VERSION;
+    *p++ = writer->flags;
+    *p++ = writer->string_count;
+    *p++ = writer->reading_count;
+    for (int i = 0; i < writer->string_count; i++) {
+        *p++ = writer->strings[i].len;
+        memcpy(p, writer->strings[i].ptr, writer->strings[i].len);
+        p += writer->strings[i].len;
+    }
+    if (writer->flags & NEO_WIRE_FLAG_SEQUENCED) {
+        *p++ = writer->origin;
+        p = varint_put(p, writer->seq);
+    }
+    for (int i = 0; i < writer->reading_count; i++) {
+        const neo_value_t *value = &writer->readings[i].value;
+        *p++ = writer->readings[i].sensor;
+        *p++ = writer->readings[i].patient;
+        *p++ = value->type;
+        switch (value->type) {
+        case NEO_VALUE_INT:
+            p = varint_put(p, zigzag(value->i));
+            break;
+        case NEO_VALUE_DECIMAL:
+            p = varint_put(p, zigzag(value->dec.mantissa));
+            *p++ = value->dec.scale;
+            break;
+        case NEO_VALUE_FLOAT:
+            memcpy(p, &value->f, sizeof(float));
+            p += sizeof(float);
+            break;
+        default:
+            *p++ = value->text.len;
+            memcpy(p, value->text.ptr, value->text.len);
+            p += value->text.len;
+            break;
+        }
+    }
+    *len = p - writer->buf;
+    return *len == writer->encoded ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static neo_str_t legacy_field(const char *field, size_t size)
+{
+    neo_str_t s = { .ptr = field, .len = strnlen(field, size) };
+    return s;
+}
+
+esp_err_t neo_wire_reader_init(neo_wire_reader_t *reader, const uint8_t *buf, size_t len)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->buf = buf;
+    reader->len = len;
+    if (len == sizeof(mesh_message_t) && buf[0] != NEO_WIRE_MAGIC) {
+        reader->legacy = true;
+        reader->remaining = 1;
+        return ESP_OK;
+    }
+    if (len < NEO_WIRE_HEADER_LEN || buf[0] != NEO_WIRE_MAGIC) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (buf[1] != NEO_WIRE_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (buf[3] > NEO_WIRE_MAX_STRINGS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    reader->flags = buf[2];
+    reader->string_count = buf[3];
+    reader->remaining = buf[4];
+    reader->pos = NEO_WIRE_HEADER_LEN;
+    for (int i = 0; i < reader->string_count; i++) {
+        if (reader->pos >= len || reader->pos + 1 + buf[reader->pos] > len) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        reader->strings[i].len = buf[reader->pos];
+        reader->strings[i].ptr = (const char *)&buf[reader->pos + 1];
+        reader->pos += 1 + reader->strings[i].len;
+    }
+    if (reader->flags & NEO_WIRE_FLAG_SEQUENCED) {
+        if (reader->pos >= len || buf[reader->pos] >= reader->string_count) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        reader->origin = reader->strings[buf[reader->pos++]];
+        if (!varint_get(reader, &reader->seq)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t neo_wire_next(neo_wire_reader_t *reader, neo_reading_t *reading)
+{
+    if (reader->remaining == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    reader->remaining--;
+    if (reader->legacy) {
+        const mesh_message_t *msg = (const mesh_message_t *)reader->buf;
+        reading->sensor_id = legacy_field(msg->sensor_id, sizeof(msg->sensor_id));
+        reading->patient_id = legacy_field(msg->patient_id, sizeof(msg->patient_id));
+        reading->value.type = NEO_VALUE_TEXT;
+        reading->value.text = legacy_field(msg->sensor_data, sizeof(msg->sensor_data));
+        return ESP_OK;
+    }
+
+    const uint8_t *buf = reader->buf;
+    uint32_t raw;
+    if (reader->pos + 3 > reader->len || buf[reader->pos] >= reader->string_count ||
+            buf[reader->pos + 1] >= reader->string_count) {
+        goto truncated;
+    }
+    reading->sensor_id = reader->strings[buf[reader->pos]];
+    reading->patient_id = reader->strings[buf[reader->pos + 1]];
+    reading->value.type = buf[reader->pos + 2];
+    reader->pos += 3;
+    switch (reading->value.type) {
+    case NEO_VALUE_INT:
+        if (!varint_get(reader, &raw)) goto truncated;
+        reading->value.i = unzigzag(raw);
+        break;
+    case NEO_VALUE_DECIMAL:
+        if (!varint_get(reader, &raw) || reader->pos >= reader->len) goto truncated;
+        reading->value.dec.mantissa = unzigzag(raw);
+        reading->value.dec.scale = buf[reader->pos++];
+        break;
+    case NEO_VALUE_FLOAT:
+        if (reader->pos + sizeof(float) > reader->len) goto truncated;
+        memcpy(&reading->value.f, &buf[reader->pos], sizeof(float));
+        reader->pos += sizeof(float);
+        break;
+    case NEO_VALUE_TEXT:
+        if (reader->pos >= reader->len || reader->pos + 1 + buf[reader->pos] > reader->len) goto truncated;
+        reading->value.text.len = buf[reader->pos];
+        reading->value.text.ptr = (const char *)&buf[reader->pos + 1];
+        reader->pos += 1 + reading->value.text.len;
+        break;
+    default:
+        goto truncated;
+    }
+    return ESP_OK;
+
+truncated:
+    reader->remaining = 0;
+    return ESP_ERR_INVALID_SIZE;
+}
+
+size_t neo_wire_ack_encode(uint8_t *buf, neo_str_t origin, uint32_t seq)
+{
+    buf[0] = NEO_WIRE_ACK_MAGIC;
+    buf[1] = NEO_WIRE_VERSION;
+    buf[2] = origin.len;
+    memcpy(buf + 3, origin.ptr, origin.len);
+    return varint_put(buf + 3 + origin.len, seq) - buf;
+}
+
+bool neo_wire_ack_parse(const uint8_t *buf, size_t len, neo_str_t *origin, uint32_t *seq)
+{
+    if (len < 4 || buf[0] != NEO_WIRE_ACK_MAGIC || buf[1] != NEO_WIRE_VERSION || 3 + (size_t)buf[2] >= len) {
+        return false;
+    }
+    neo_wire_reader_t reader = { .buf = buf, .len = len, .pos = 3 + buf[2] };
+    origin->ptr = (const char *)buf + 3;
+    origin->len = buf[2];
+    return varint_get(&reader, seq) && reader.pos == len;
+}
+
+size_t neo_wire_hint_encode(uint8_t *buf, const neo_wire_hint_t *hint)
+{
+    buf[0] = NEO_WIRE_HINT_MAGIC;
+    buf[1] = NEO_WIRE_VERSION;
+    buf[2] = hint->stretch;
+    buf[3] = hint->ttl_s & 0xff;
+    buf[4] = hint->ttl_s >> 8;
+    return NEO_WIRE_HINT_LEN;
+}
+
+bool neo_wire_hint_parse(const uint8_t *buf, size_t len, neo_wire_hint_t *hint)
+{
+    if (len != NEO_WIRE_HINT_LEN || buf[0] != NEO_WIRE_HINT_MAGIC || buf[1] != NEO_WIRE_VERSION || buf[2] == 0) {
+        return false;
+    }
+    hint->stretch = buf[2];
+    hint->ttl_s = buf[3] | buf[4] << 8;
+    return true;
+}
+
+esp_err_t neo_value_parse(const char *text, neo_value_t *value)
+{
+    // Plain integers and decimals with up to 9 significant digits are sent as numbers, anything
+    // that would not be formatted back to the same text ("-0", ".5", "007") is sent as it is
+    const char *p = text;
+    bool negative = (*p == '-');
+    int64_t mantissa = 0;
+    int digits = 0, scale = -1;
+
+    if (negative) p++;
+    if (p[0] == '0' && p[1] >= '0' && p[1] <= '9') {
+        p = ""; // keep leading zeros as they are
+        digits = -1;
+    }
+    for (; *p != '\0'; p++) {
+        if (*p == '.' && scale < 0 && digits > 0) {
+            scale = 0;
+        } else if (*p >= '0' && *p <= '9' && digits < 9) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits++;
+            if (scale >= 0) scale++;
+        } else {
+            break;
+        }
+    }
+    if (*p == '\0' && digits > 0 && scale != 0 && !(negative && mantissa == 0)) {
+        if (negative) mantissa = -mantissa;
+        if (scale < 0) {
+            value->type = NEO_VALUE_INT;
+            value->i = (int32_t)mantissa;
+        } else {
+            value->type = NEO_VALUE_DECIMAL;
+            value->dec.mantissa = (int32_t)mantissa;
+            value->dec.scale = scale;
+        }
+        return ESP_OK;
+    }
+    size_t len = strnlen(text, UINT8_MAX + 1);
+    if (len > UINT8_MAX) {
+        return ESP_ERR_INVALID_SIZE; // the length is one byte on the wire
+    }
+    value->type = NEO_VALUE_TEXT;
+    value->text.ptr = text;
+    value->text.len = len;
+    return ESP_OK;
+}
+
+int neo_value_format(const neo_value_t *value, char *out, size_t size)
+{
+    switch (value->type) {
+    case NEO_VALUE_INT:
+        return snprintf(out, size, "%" PRId32, value->i);
+    case NEO_VALUE_DECIMAL: {
+        uint32_t div = 1;
+        for (int i = 0; i < value->dec.scale && i < 9; i++) div *= 10;
+        uint32_t mag = value->dec.mantissa < 0 ? -(uint32_t)value->dec.mantissa : (uint32_t)value->dec.mantissa;
+        return snprintf(out, size, "%s%" PRIu32 ".%0*" PRIu32, value->dec.mantissa < 0 ? "-" : "",
+                        mag / div, (int)value->dec.scale, mag % div);
+    }
+    case NEO_VALUE_FLOAT:
+        return snprintf(out, size, "%g", (double)value->f);
+    default:
+        return snprintf(out, size, "%.*s", value->text.len, value->text.ptr);
+    }
+}
+
+static void copy_str(char *dst, size_t size, neo_str_t s)
+{
+    size_t len = s.len < size - 1 ? s.len : size - 1;
+    memcpy(dst, s.ptr, len);
+    dst[len] = '\0';
+}
+
+void neo_reading_to_message(const neo_reading_t *reading, mesh_message_t *msg)
+{
+    copy_str(msg->sensor_id, sizeof(msg->sensor_id), reading->sensor_id);
+    copy_str(msg->patient_id, sizeof(msg->patient_id), reading->patient_id);
+    neo_value_format(&reading->value, msg->sensor_data, sizeof(msg->sensor_data));
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "neolink.h"
+
+/* Variable-length mesh frame, little endian:
+ *   magic, version, flags, string count, reading count
+ *   string table: [len][bytes] per sensor/patient ID, each ID appears once per frame
+ *   with NEO_WIRE_FLAG_SEQUENCED: [origin index][sequence varint]
+ *   readings: [sensor index][patient index][value type][value]
+ * Values are zigzag varints (INT), a varint mantissa plus decimal places (DECIMAL),
+ * a 32-bit float (FLOAT) or [len][bytes] (TEXT).
+ * A packet of exactly sizeof(mesh_message_t) bytes not starting with the magic is read as
+ * the original fixed struct, so old sensor firmware keeps working. */
+#define NEO_WIRE_MAGIC 0xA5
+#define NEO_WIRE_VERSION 1
+#define NEO_WIRE_HEADER_LEN 5
+#define NEO_WIRE_MAX_FRAME 1456 //fits one mesh packet
+#define NEO_WIRE_MAX_STRINGS 32
+#define NEO_WIRE_MAX_READINGS 32
+
+#define NEO_WIRE_FLAG_CRITICAL 0x01 //alerts: uploaded ahead of routine readings, never batched
+#define NEO_WIRE_FLAG_SEQUENCED 0x02 //carries the sending node's ID and frame sequence number, see dedup.h
+#define NEO_WIRE_FLAG_ACK 0x04 //the sender wants an acknowledgement frame back once the root has the frame
+
+/* Acknowledgement sent by the root: magic, version, [len][origin], sequence varint. It carries the
+ * origin because a frame forwarded during a root switch is acknowledged to the forwarding node. */
+#define NEO_WIRE_ACK_MAGIC 0xA7
+#define NEO_WIRE_ACK_MAX (3 + UINT8_MAX + 5)
+
+/* Flow control hint broadcast by the root: magic, version, stretch, ttl (2 bytes). See flow.h. */
+#define NEO_WIRE_HINT_MAGIC 0xA8
+#define NEO_WIRE_HINT_LEN 5
+
+typedef enum {
+    NEO_VALUE_INT = 1,
+    NEO_VALUE_DECIMAL = 2,
+    NEO_VALUE_FLOAT = 3,
+    NEO_VALUE_TEXT = 4,
+} neo_value_type_t;
+
+// Points into a caller or frame buffer, not NUL terminated
+typedef struct {
+    const char *ptr;
+    uint8_t len;
+} neo_str_t;
+
+typedef struct {
+    neo_value_type_t type;
+    union {
+        int32_t i;
+        struct {
+            int32_t mantissa;
+            uint8_t scale; //decimal places
+        } dec;
+        float f;
+        neo_str_t text;
+    };
+} neo_value_t;
+
+typedef struct {
+    neo_str_t sensor_id;
+    neo_str_t patient_id;
+    neo_value_t value;
+} neo_reading_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t encoded; //frame size so far
+    neo_str_t strings[NEO_WIRE_MAX_STRINGS];
+    uint8_t string_count;
+    struct {
+        uint8_t sensor;
+        uint8_t patient;
+        neo_value_t value;
+    } readings[NEO_WIRE_MAX_READINGS];
+    uint8_t reading_count;
+    uint8_t flags; //NEO_WIRE_FLAG_*, may be set any time before neo_wire_finish()
+    uint8_t origin; //string index of the sending node, with NEO_WIRE_FLAG_SEQUENCED
+    uint32_t seq;
+} neo_wire_writer_t;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+    neo_str_t strings[NEO_WIRE_MAX_STRINGS];
+    uint8_t string_count;
+    uint8_t remaining; //readings not yet returned
+    uint8_t flags; //NEO_WIRE_FLAG_*, unknown flags are ignored
+    neo_str_t origin; //with NEO_WIRE_FLAG_SEQUENCED
+    uint32_t seq;
+    bool legacy;
+} neo_wire_reader_t;
+
+typedef struct {
+    uint8_t stretch; //1: send as configured, n: wait n times as long before sending a frame
+    uint16_t ttl_s; //the hint lapses after this long unless repeated
+} neo_wire_hint_t;
+
+/* Encoding. The ID and text strings must stay valid until neo_wire_finish(). */
+void neo_wire_writer_init(neo_wire_writer_t *writer, uint8_t *buf, size_t cap);
+esp_err_t neo_wire_add(neo_wire_writer_t *writer, const char *sensor_id, const char *patient_id,
+                       const neo_value_t *value);
+esp_err_t neo_wire_finish(neo_wire_writer_t *writer, size_t *len);
+/* Number the frame: `origin` identifies the sending node, `seq` increases by one per frame it sends.
+ * Call once per frame, before neo_wire_finish(). */
+esp_err_t neo_wire_set_sequence(neo_wire_writer_t *writer, const char *origin, uint32_t seq);
+
+/* Acknowledgement frames. Encoding returns the length, at most NEO_WIRE_ACK_MAX. */
+size_t neo_wire_ack_encode(uint8_t *buf, neo_str_t origin, uint32_t seq);
+bool neo_wire_ack_parse(const uint8_t *buf, size_t len, neo_str_t *origin, uint32_t *seq);
+
+/* Flow control hints, always NEO_WIRE_HINT_LEN bytes. */
+size_t neo_wire_hint_encode(uint8_t *buf, const neo_wire_hint_t *hint);
+bool neo_wire_hint_parse(const uint8_t *buf, size_t len, neo_wire_hint_t *hint);
+
+/* Decoding, without copying: returned readings point into `buf`. */
+esp_err_t neo_wire_reader_init(neo_wire_reader_t *reader, const uint8_t *buf, size_t len);
+/* ESP_OK with the next reading, ESP_ERR_NOT_FOUND after the last one, ESP_ERR_INVALID_SIZE if truncated. */
+esp_err_t neo_wire_next(neo_wire_reader_t *reader, neo_reading_t *reading);
+
+/* Pick the most compact type for a textual reading such as "98.6" that formats back to the same
+ * text; TEXT values point into `text`. Returns ESP_ERR_INVALID_SIZE for text longer than
+ * UINT8_MAX bytes, which a frame cannot carry. */
+esp_err_t neo_value_parse(const char *text, neo_value_t *value);
+int neo_value_format(const neo_value_t *value, char *out, size_t size);
+
+void neo_reading_to_message(const neo_reading_t *reading, mesh_message_t *msg);
@@ -0,0 +1,8 @@
+#pragma once
+
+// Reading sent by a sensor node to the root
+typedef struct {
+    char sensor_id[32];
+    char patient_id[32];
+    char sensor_data[128];
+} mesh_message_t;
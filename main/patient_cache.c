@@ -0,0 +1,237 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "patient_cache.h"
+
+typedef struct {
+    char id[PATIENT_ID_LEN];
+    uint32_t hash;
+    uint32_t last_used; //access clock value, lowest is evicted first
+    int64_t expires_us;
+    uint8_t state; //patient_state_t, PATIENT_UNKNOWN marks a free slot
+} patient_entry_t;
+
+static const char *TAG = "neoPatients";
+static const char *NVS_NAMESPACE = "neolink";
+static const char *NVS_KEY = "patients";
+
+static patient_entry_t entries[PATIENT_CACHE_SIZE];
+static char saved_ids[PATIENT_CACHE_SIZE][PATIENT_ID_LEN]; //staging area for NVS
+static uint32_t access_clock = 0;
+static bool persist_enabled = false;
+static bool dirty = false;
+static patient_cache_stats_t stats = {0};
+static portMUX_TYPE cache_lock = portMUX_INITIALIZER_UNLOCKED;
+
+_Static_assert((PATIENT_CACHE_SIZE & (PATIENT_CACHE_SIZE - 1)) == 0, "PATIENT_CACHE_SIZE must be a power of two");
+
+// FNV-1a
+static uint32_t patient_hash(const char *id)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < PATIENT_ID_LEN && id[i] != '\0'; i++) {
+        hash = (hash ^ (uint8_t)id[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// An entry keeps at most PATIENT_ID_LEN - 1 characters; longer IDs are never cached so two of
+// them sharing a prefix cannot be mistaken for each other
+static bool patient_id_fits(const char *id)
+{
+    return strnlen(id, PATIENT_ID_LEN) < PATIENT_ID_LEN;
+}
+
+// Entry holding `id`, or NULL. Must be called with cache_lock held.
+static patient_entry_t *patient_find(const char *id, uint32_t hash)
+{
+    for (int i = 0; i < PATIENT_CACHE_WAYS; i++) {
+        patient_entry_t *entry = &entries[(hash + i) & (PATIENT_CACHE_SIZE - 1)];
+        if (entry->state != PATIENT_UNKNOWN && entry->hash == hash &&
+                strncmp(entry->id, id, PATIENT_ID_LEN) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void patient_insert(const char *id, uint32_t hash, patient_state_t state, int64_t now_us)
+{
+    patient_entry_t *entry = patient_find(id, hash);
+    if (entry == NULL) {
+        // Take a free slot, else evict the least recently used one in the probe window
+        for (int i = 0; i < PATIENT_CACHE_WAYS; i++) {
+            patient_entry_t *slot = &entries[(hash + i) & (PATIENT_CACHE_SIZE - 1)];
+            if (slot->state == PATIENT_UNKNOWN) {
+                entry = slot;
+                break;
+            }
+            if (entry == NULL || (int32_t)(slot->last_used - entry->last_used) < 0) {
+                entry = slot;
+            }
+        }
+        if (entry->state != PATIENT_UNKNOWN) {
+            stats.evictions++;
+        }
+        strcpy(entry->id, id);
+        entry->hash = hash;
+    }
+    if (state == PATIENT_EXISTS && entry->state != PATIENT_EXISTS) {
+        dirty = true;
+    }
+    entry->state = state;
+    entry->last_used = ++access_clock;
+    entry->expires_us = now_us + (state == PATIENT_EXISTS ? PATIENT_CACHE_TTL_MS : PATIENT_CACHE_NEGATIVE_TTL_MS) * 1000LL;
+}
+
+esp_err_t patient_cache_init(bool persist)
+{
+    persist_enabled = persist;
+    if (!persist) {
+        return ESP_OK;
+    }
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err; // nothing saved yet
+    }
+    size_t size = sizeof(saved_ids);
+    err = nvs_get_blob(handle, NVS_KEY, saved_ids, &size);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+    }
+    int64_t now = esp_timer_get_time();
+    int count = size / PATIENT_ID_LEN;
+    portENTER_CRITICAL(&cache_lock);
+    for (int i = 0; i < count; i++) {
+        saved_ids[i][PATIENT_ID_LEN - 1] = '\0';
+        patient_insert(saved_ids[i], patient_hash(saved_ids[i]), PATIENT_EXISTS, now);
+    }
+    dirty = false;
+    portEXIT_CRITICAL(&cache_lock);
+    ESP_LOGI(TAG, "Restored %d known patient(s) from NVS", count);
+    return ESP_OK;
+}
+
+patient_state_t patient_cache_lookup(const char *patient_id)
+{
+    if (!patient_id_fits(patient_id)) {
+        portENTER_CRITICAL(&cache_lock);
+        stats.misses++;
+        portEXIT_CRITICAL(&cache_lock);
+        return PATIENT_UNKNOWN;
+    }
+    uint32_t hash = patient_hash(patient_id);
+    patient_state_t state = PATIENT_UNKNOWN;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&cache_lock);
+    patient_entry_t *entry = patient_find(patient_id, hash);
+    if (entry != NULL && entry->expires_us <= now) {
+        entry->state = PATIENT_UNKNOWN;
+        stats.expired++;
+        entry = NULL;
+    }
+    if (entry == NULL) {
+        stats.misses++;
+    } else {
+        state = entry->state;
+        entry->last_used = ++access_clock;
+        if (state == PATIENT_EXISTS) {
+            stats.hits++;
+        } else {
+            stats.negative_hits++;
+        }
+    }
+    portEXIT_CRITICAL(&cache_lock);
+    return state;
+}
+
+void patient_cache_store(const char *patient_id, patient_state_t state)
+{
+    if (state == PATIENT_UNKNOWN) {
+        patient_cache_invalidate(patient_id);
+        return;
+    }
+    if (!patient_id_fits(patient_id)) {
+        return;
+    }
+    uint32_t hash = patient_hash(patient_id);
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&cache_lock);
+    patient_insert(patient_id, hash, state, now);
+    portEXIT_CRITICAL(&cache_lock);
+}
+
+void patient_cache_invalidate(const char *patient_id)
+{
+    if (!patient_id_fits(patient_id)) {
+        return;
+    }
+    uint32_t hash = patient_hash(patient_id);
+    portENTER_CRITICAL(&cache_lock);
+    patient_entry_t *entry = patient_find(patient_id, hash);
+    if (entry != NULL) {
+        if (entry->state == PATIENT_EXISTS) {
+            dirty = true;
+        }
+        entry->state = PATIENT_UNKNOWN;
+        stats.invalidations++;
+    }
+    portEXIT_CRITICAL(&cache_lock);
+}
+
+size_t patient_cache_export(char (*ids)[PATIENT_ID_LEN], size_t max)
+{
+    size_t count = 0;
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&cache_lock);
+    for (int i = 0; i < PATIENT_CACHE_SIZE && count < max; i++) {
+        if (entries[i].state == PATIENT_EXISTS && entries[i].expires_us > now) {
+            memcpy(ids[count++], entries[i].id, PATIENT_ID_LEN);
+        }
+    }
+    portEXIT_CRITICAL(&cache_lock);
+    return count;
+}
+
+esp_err_t patient_cache_save(void)
+{
+    if (!persist_enabled || !dirty) {
+        return ESP_OK;
+    }
+    int count = 0;
+    portENTER_CRITICAL(&cache_lock);
+    for (int i = 0; i < PATIENT_CACHE_SIZE; i++) {
+        if (entries[i].state == PATIENT_EXISTS) {
+            memcpy(saved_ids[count++], entries[i].id, PATIENT_ID_LEN);
+        }
+    }
+    dirty = false;
+    portEXIT_CRITICAL(&cache_lock);
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, NVS_KEY, saved_ids, count * PATIENT_ID_LEN);
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        dirty = true; // try again next time
+        ESP_LOGW(TAG, "Saving known patients failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+void patient_cache_get_stats(patient_cache_stats_t *out)
+{
+    portENTER_CRITICAL(&cache_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&cache_lock);
+}
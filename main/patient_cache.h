@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define PATIENT_CACHE_SIZE 64 //entries, power of two
+#define PATIENT_CACHE_WAYS 8 //slots probed per lookup, the least recently used one is evicted
+#define PATIENT_CACHE_TTL_MS (60 * 60 * 1000) //how long a known patient is trusted
+#define PATIENT_CACHE_NEGATIVE_TTL_MS (30 * 1000) //how long a missing patient is trusted
+#define PATIENT_ID_LEN 32 //with the NUL, longer IDs are not cached and always ask the API
+
+typedef enum {
+    PATIENT_UNKNOWN, //not cached, ask the API
+    PATIENT_EXISTS,
+    PATIENT_ABSENT,
+} patient_state_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t negative_hits;
+    uint32_t misses;
+    uint32_t expired;
+    uint32_t evictions;
+    uint32_t invalidations;
+} patient_cache_stats_t;
+
+/* Set up the cache; with `persist` set, known patients are restored from NVS. */
+esp_err_t patient_cache_init(bool persist);
+
+patient_state_t patient_cache_lookup(const char *patient_id);
+void patient_cache_store(const char *patient_id, patient_state_t state);
+void patient_cache_invalidate(const char *patient_id);
+
+/* Copy the IDs of up to `max` known patients, e.g. to hand them to the next root. Returns the count. */
+size_t patient_cache_export(char (*ids)[PATIENT_ID_LEN], size_t max);
+
+/* Write known patients to NVS if anything changed since the last save. */
+esp_err_t patient_cache_save(void);
+
+void patient_cache_get_stats(patient_cache_stats_t *stats);
@@ -0,0 +1,382 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "budget.h"
+#include "neo_wire.h"
+#include "producer.h"
+
+#define PRODUCER_STACK 3072
+#define PRODUCER_ALERT_FRAME (NEO_WIRE_HEADER_LEN + 2 * PRODUCER_ID_LEN + 16) //one reading, IDs at their longest
+
+typedef struct {
+    uint32_t count;
+    float sum;
+    float min;
+    float max;
+    int64_t end_us;
+} producer_window_t;
+
+static const char *TAG = "neoSensor";
+static producer_config_t producer_config;
+static char sensor_id[PRODUCER_ID_LEN];
+static char patient_id[PRODUCER_ID_LEN];
+static char min_id[PRODUCER_ID_LEN + 4];
+static char max_id[PRODUCER_ID_LEN + 4];
+static uint8_t frames[2][NEO_WIRE_MAX_FRAME]; //one is filled while the other waits for its acknowledgement
+static uint8_t *frame = frames[0];
+static neo_wire_writer_t writer;
+static uint32_t next_seq = 0;
+static struct {
+    const uint8_t *frame; //NULL when nothing waits
+    size_t len;
+    uint32_t seq;
+    int resends;
+    int64_t sent_us;
+} unacked = {0};
+static uint32_t acked_seq = 0; //set by producer_ack() under stats_lock
+static bool ack_seen = false;
+static uint8_t stretch = 1; //flow control hint from the root, under stats_lock
+static int64_t stretch_until_us = 0;
+static uint8_t alert_frame[PRODUCER_ALERT_FRAME];
+static neo_wire_writer_t alert_writer;
+static bool alerting = false; //an alert went out and samples are still out of range
+static int64_t last_alert_us = 0;
+static int64_t pending_since_us = 0; //when the oldest reading in the writer was added
+static bool has_sent = false;
+static float last_sent = 0;
+static int64_t last_sent_us = 0;
+static producer_stats_t stats = {0};
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void producer_value(float v, neo_value_t *value)
+{
+    float scaled = v;
+    for (int i = 0; i < producer_config.decimals; i++) {
+        scaled *= 10;
+    }
+    if (fabsf(scaled) < (float)INT32_MAX) {
+        value->type = producer_config.decimals > 0 ? NEO_VALUE_DECIMAL : NEO_VALUE_INT;
+        if (producer_config.decimals > 0) {
+            value->dec.mantissa = (int32_t)lroundf(scaled);
+            value->dec.scale = producer_config.decimals;
+        } else {
+            value->i = (int32_t)lroundf(scaled);
+        }
+    } else {
+        value->type = NEO_VALUE_FLOAT;
+        value->f = v;
+    }
+}
+
+// Start an empty frame with the next sequence number
+static void producer_writer_init(void)
+{
+    neo_wire_writer_init(&writer, frame, NEO_WIRE_MAX_FRAME);
+    neo_wire_set_sequence(&writer, producer_config.sensor_id, next_seq++);
+    if (producer_config.ack_timeout_ms > 0) {
+        writer.flags |= NEO_WIRE_FLAG_ACK;
+    }
+}
+
+/* Forget the waiting frame once it is acknowledged, send it again when the acknowledgement is late
+ * and give it up after PRODUCER_ACK_RETRIES resends. The root drops the copies it already has. */
+static void producer_check_ack(int64_t now)
+{
+    if (unacked.frame == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&stats_lock);
+    bool done = ack_seen && acked_seq == unacked.seq;
+    if (done) {
+        stats.acked++;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    if (done) {
+        unacked.frame = NULL;
+        return;
+    }
+    if (now - unacked.sent_us < producer_config.ack_timeout_ms * 1000LL) {
+        return;
+    }
+    if (unacked.resends >= PRODUCER_ACK_RETRIES) {
+        ESP_LOGW(TAG, "Frame %" PRIu32 " was never acknowledged", unacked.seq);
+        portENTER_CRITICAL(&stats_lock);
+        stats.unacked++;
+        portEXIT_CRITICAL(&stats_lock);
+        unacked.frame = NULL;
+        return;
+    }
+    esp_err_t err = producer_config.send(producer_config.ctx, unacked.frame, unacked.len, false);
+    portENTER_CRITICAL(&stats_lock);
+    if (err == ESP_OK) {
+        stats.resent++;
+        stats.bytes += unacked.len;
+    } else {
+        stats.send_failures++;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    unacked.resends++;
+    unacked.sent_us = now;
+}
+
+// Send what the writer holds. On failure the readings stay for the next attempt.
+static void producer_flush(int64_t now)
+{
+    size_t len = 0;
+    if (writer.reading_count == 0) {
+        return;
+    }
+    producer_check_ack(now);
+    if (unacked.frame != NULL) {
+        return; // one frame in flight at a time, this one waits in the writer
+    }
+    neo_wire_finish(&writer, &len);
+    esp_err_t err = producer_config.send(producer_config.ctx, frame, len, false);
+    portENTER_CRITICAL(&stats_lock);
+    if (err == ESP_OK) {
+        stats.frames++;
+        stats.bytes += len;
+    } else {
+        stats.send_failures++;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Sending %d reading(s) failed: %s", writer.reading_count, esp_err_to_name(err));
+        return;
+    }
+    if (writer.flags & NEO_WIRE_FLAG_ACK) {
+        unacked.frame = frame;
+        unacked.len = len;
+        unacked.seq = writer.seq;
+        unacked.resends = 0;
+        unacked.sent_us = now;
+        frame = frame == frames[0] ? frames[1] : frames[0];
+    }
+    producer_writer_init();
+}
+
+static void producer_add(const char *sensor_id, float v, int64_t now)
+{
+    neo_value_t value;
+    producer_value(v, &value);
+    if (neo_wire_add(&writer, sensor_id, producer_config.patient_id, &value) != ESP_OK) {
+        producer_flush(now);
+        if (writer.reading_count > 0) {
+            // Still unsent, make room rather than block sampling
+            portENTER_CRITICAL(&stats_lock);
+            stats.dropped += writer.reading_count;
+            portEXIT_CRITICAL(&stats_lock);
+            producer_writer_init();
+        }
+        neo_wire_add(&writer, sensor_id, producer_config.patient_id, &value);
+    }
+    if (writer.reading_count == 1) {
+        pending_since_us = now;
+    }
+    portENTER_CRITICAL(&stats_lock);
+    stats.readings++;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+/* A sample outside the alert range goes out at once in a critical frame of its own: when it first
+ * crosses, then at most once per window while it stays out. A failed send is tried on the next sample. */
+static void producer_check_alert(float v, int64_t now)
+{
+    size_t len = 0;
+    neo_value_t value;
+
+    if (producer_config.alert_low >= producer_config.alert_high) {
+        return;
+    }
+    if (v >= producer_config.alert_low && v <= producer_config.alert_high) {
+        alerting = false;
+        return;
+    }
+    if (alerting && now - last_alert_us < producer_config.window_ms * 1000LL) {
+        return;
+    }
+    producer_value(v, &value);
+    neo_wire_writer_init(&alert_writer, alert_frame, sizeof(alert_frame));
+    alert_writer.flags = NEO_WIRE_FLAG_CRITICAL;
+    // Numbered for the duplicate filter but not acknowledged: a late resend is worth less than the next alert
+    if (neo_wire_set_sequence(&alert_writer, producer_config.sensor_id, next_seq++) != ESP_OK ||
+            neo_wire_add(&alert_writer, producer_config.sensor_id, producer_config.patient_id, &value) != ESP_OK ||
+            neo_wire_finish(&alert_writer, &len) != ESP_OK) {
+        return;
+    }
+    esp_err_t err = producer_config.send(producer_config.ctx, alert_frame, len, true);
+    portENTER_CRITICAL(&stats_lock);
+    if (err == ESP_OK) {
+        stats.alerts++;
+        stats.bytes += len;
+    } else {
+        stats.send_failures++;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Sending alert failed: %s", esp_err_to_name(err));
+        return;
+    }
+    alerting = true;
+    last_alert_us = now;
+}
+
+// Stretch factor in force, 1 once the root's last hint has lapsed
+static int producer_stretch(int64_t now)
+{
+    portENTER_CRITICAL(&stats_lock);
+    int s = now < stretch_until_us ? stretch : 1;
+    portEXIT_CRITICAL(&stats_lock);
+    return s;
+}
+
+static void producer_close_window(producer_window_t *window, int64_t now)
+{
+    float mean = window->sum / window->count;
+    bool quiet = has_sent && now - last_sent_us < producer_config.heartbeat_ms * 1000LL * producer_stretch(now) &&
+                 fabsf(mean - last_sent) < producer_config.deadband &&
+                 fabsf(window->min - last_sent) < producer_config.deadband &&
+                 fabsf(window->max - last_sent) < producer_config.deadband;
+
+    portENTER_CRITICAL(&stats_lock);
+    stats.windows++;
+    if (quiet) {
+        stats.suppressed++;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    if (!quiet) {
+        producer_add(producer_config.sensor_id, mean, now);
+        if (producer_config.extremes && window->min != window->max) {
+            producer_add(min_id, window->min, now);
+            producer_add(max_id, window->max, now);
+        }
+        has_sent = true;
+        last_sent = mean;
+        last_sent_us = now;
+    }
+    window->count = 0;
+    window->sum = 0;
+}
+
+static void producer_log_stats(void)
+{
+    producer_stats_t s;
+    producer_get_stats(&s);
+    ESP_LOGI(TAG, "samples:%" PRIu32 " (errors:%" PRIu32 "), windows:%" PRIu32 ", suppressed:%" PRIu32 ", readings:%" PRIu32 ", frames:%" PRIu32 ", alerts:%" PRIu32 ", bytes:%" PRIu32 ", send failures:%" PRIu32 ", dropped:%" PRIu32 ", acked:%" PRIu32 ", resent:%" PRIu32 ", unacked:%" PRIu32 ", hints:%" PRIu32 " (stretch x%d)",
+             s.samples, s.sample_errors, s.windows, s.suppressed, s.readings, s.frames, s.alerts, s.bytes,
+             s.send_failures, s.dropped, s.acked, s.resent, s.unacked, s.hints, producer_stretch(esp_timer_get_time()));
+}
+
+static void producer_task(void *arg)
+{
+    producer_window_t window = { .end_us = esp_timer_get_time() + producer_config.window_ms * 1000LL };
+    int64_t next_stats = esp_timer_get_time() + PRODUCER_STATS_MS * 1000LL;
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (true) {
+        xTaskDelayUntil(&last_wake, pdMS_TO_TICKS(producer_config.sample_ms));
+        int64_t now = esp_timer_get_time();
+        float v = 0;
+        esp_err_t err = producer_config.sample(producer_config.ctx, &v);
+        portENTER_CRITICAL(&stats_lock);
+        if (err == ESP_OK) {
+            stats.samples++;
+        } else {
+            stats.sample_errors++;
+        }
+        portEXIT_CRITICAL(&stats_lock);
+        if (err == ESP_OK) {
+            window.min = window.count == 0 || v < window.min ? v : window.min;
+            window.max = window.count == 0 || v > window.max ? v : window.max;
+            window.sum += v;
+            window.count++;
+            producer_check_alert(v, now);
+        }
+        if (now >= window.end_us) {
+            if (window.count > 0) {
+                producer_close_window(&window, now);
+            }
+            while (window.end_us <= now) {
+                window.end_us += producer_config.window_ms * 1000LL;
+            }
+        }
+        producer_check_ack(now);
+        // Under backpressure readings wait longer, so frames go out fuller and less often
+        int s = producer_stretch(now);
+        int64_t latency_us = (s > 1 && producer_config.max_latency_ms == 0 ? producer_config.window_ms :
+                              producer_config.max_latency_ms) * 1000LL * s;
+        if (writer.reading_count > 0 && now - pending_since_us >= latency_us) {
+            producer_flush(now);
+        }
+        if (now >= next_stats) {
+            producer_log_stats();
+            next_stats += PRODUCER_STATS_MS * 1000LL;
+        }
+    }
+}
+
+esp_err_t producer_start(const producer_config_t *config)
+{
+    static bool is_started = false;
+    if (is_started) {
+        return ESP_OK;
+    }
+    if (config == NULL || config->sensor_id == NULL || config->patient_id == NULL ||
+            strlen(config->sensor_id) >= PRODUCER_ID_LEN || strlen(config->patient_id) >= PRODUCER_ID_LEN ||
+            config->sample_ms == 0 || config->window_ms < config->sample_ms ||
+            config->decimals > 6 || config->sample == NULL || config->send == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // The frame writer keeps pointers to the IDs, so they live here
+    producer_config = *config;
+    producer_config.sensor_id = strcpy(sensor_id, config->sensor_id);
+    producer_config.patient_id = strcpy(patient_id, config->patient_id);
+    snprintf(min_id, sizeof(min_id), "%s.min", config->sensor_id);
+    snprintf(max_id, sizeof(max_id), "%s.max", config->sensor_id);
+    // A random start makes a reboot look like a restart to the root's duplicate filter, see dedup.h
+    next_seq = esp_random();
+    producer_writer_init();
+    TaskHandle_t task = NULL;
+    if (xTaskCreate(producer_task, "neoSensor", PRODUCER_STACK, NULL, 5, &task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    budget_watch(task, PRODUCER_STACK);
+    is_started = true;
+    ESP_LOGI(TAG, "Sampling %s every %" PRIu32 " ms, %" PRIu32 " ms windows, frames sent within %" PRIu32 " ms",
+             config->sensor_id, config->sample_ms, config->window_ms, config->max_latency_ms);
+    return ESP_OK;
+}
+
+void producer_ack(const char *origin, size_t origin_len, uint32_t seq)
+{
+    if (origin_len != strlen(sensor_id) || strncmp(origin, sensor_id, origin_len) != 0) {
+        return;
+    }
+    portENTER_CRITICAL(&stats_lock);
+    acked_seq = seq;
+    ack_seen = true;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void producer_hint(uint8_t factor, uint32_t ttl_ms)
+{
+    int64_t until = esp_timer_get_time() + ttl_ms * 1000LL;
+    portENTER_CRITICAL(&stats_lock);
+    stretch = factor > 0 ? factor : 1;
+    stretch_until_us = until;
+    stats.hints++;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void producer_get_stats(producer_stats_t *out)
+{
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Sensor-side pipeline for non-root nodes: sample periodically, aggregate each window into its
+ * mean (and optionally min and max), skip windows that stayed inside the deadband, and pack the
+ * remaining readings into neo_wire frames. A frame is sent when it is full or when its oldest
+ * reading has waited max_latency_ms, so the radio wakes once per frame rather than per sample.
+ * A sample outside the alert range skips all of that and is sent at once in a critical frame.
+ * Frames are numbered so the root can drop duplicates. With ack_timeout_ms set, a routine frame is
+ * kept until the root acknowledges it and sent again when no acknowledgement arrives in time.
+ * A flow control hint from the root (see flow.h) stretches max_latency_ms and heartbeat_ms until it
+ * lapses, so a congested root gets fewer, fuller frames. Alerts are never held back. */
+#define PRODUCER_STATS_MS 60000 //how often the counters are logged
+#define PRODUCER_ID_LEN 32
+#define PRODUCER_ACK_RETRIES 3 //resends of an unacknowledged frame before it is given up
+
+typedef esp_err_t (*producer_sample_fn)(void *ctx, float *value);
+/* `critical` frames carry NEO_WIRE_FLAG_CRITICAL and should not wait behind routine traffic. */
+typedef esp_err_t (*producer_send_fn)(void *ctx, const uint8_t *frame, size_t len, bool critical);
+
+typedef struct {
+    const char *sensor_id; //min and max go out as <sensor_id>.min and <sensor_id>.max
+    const char *patient_id;
+    uint32_t sample_ms; //sampling period
+    uint32_t window_ms; //aggregation window, a multiple of sample_ms
+    float deadband; //windows whose mean, min and max all stay this close to the last sent mean are skipped
+    uint32_t heartbeat_ms; //send a window anyway when nothing was sent for this long
+    uint32_t max_latency_ms; //longest an aggregated reading waits for its frame to fill, 0 to send every window
+    uint8_t decimals; //values are sent as decimals with this many places
+    bool extremes; //also send the min and max of windows with more than one distinct sample
+    float alert_low; //samples below alert_low or above alert_high are sent at once as alerts
+    float alert_high; //set both equal to disable alerts
+    uint32_t ack_timeout_ms; //wait this long for the root to acknowledge a routine frame, 0 to not ask
+    producer_sample_fn sample;
+    producer_send_fn send;
+    void *ctx; //passed to sample and send
+} producer_config_t;
+
+typedef struct {
+    uint32_t samples;
+    uint32_t sample_errors;
+    uint32_t windows;
+    uint32_t suppressed; //windows inside the deadband
+    uint32_t readings; //readings put into frames
+    uint32_t frames; //frames sent
+    uint32_t bytes; //frame bytes sent
+    uint32_t send_failures;
+    uint32_t dropped; //readings lost because a frame could not be sent before the next one filled up
+    uint32_t alerts; //critical frames sent
+    uint32_t acked; //frames the root acknowledged
+    uint32_t resent; //frames sent again for want of an acknowledgement
+    uint32_t unacked; //frames given up after PRODUCER_ACK_RETRIES resends
+    uint32_t hints; //flow control hints received
+} producer_stats_t;
+
+/* Start the sampling task. Calling it again once started does nothing. */
+esp_err_t producer_start(const producer_config_t *config);
+
+/* Pass on an acknowledgement received from the root, see neo_wire_ack_parse(). Acknowledgements
+ * for another node's frames are ignored. */
+void producer_ack(const char *origin, size_t origin_len, uint32_t seq);
+
+/* Apply a flow control hint from the root: wait `factor` times as long before sending, for `ttl_ms`. */
+void producer_hint(uint8_t factor, uint32_t ttl_ms);
+
+void producer_get_stats(producer_stats_t *stats);
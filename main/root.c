@@ -0,0 +1,217 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "dedup.h"
+#include "dns_cache.h"
+#include "http_pool.h"
+#include "metrics.h"
+#include "neo_wire.h"
+#include "patient_cache.h"
+#include "spool.h"
+#include "root.h"
+
+static const char *TAG = "Root";
+static mesh_message_t upload_slots[ROOT_QUEUE_LEN];
+static int64_t upload_stamps[ROOT_QUEUE_LEN];
+static mesh_message_t critical_slots[ROOT_CRITICAL_QUEUE_LEN];
+static int64_t critical_stamps[ROOT_CRITICAL_QUEUE_LEN];
+static msg_queue_t upload_queue;
+static msg_queue_t critical_queue;
+static msg_queue_t *lanes[UPLOAD_LANES] = {
+    [UPLOAD_LANE_CRITICAL] = &critical_queue,
+    [UPLOAD_LANE_ROUTINE] = &upload_queue,
+};
+static mesh_message_t handoff_msgs[SPOOL_GROUP_MAX];
+static bool spool_enabled = false;
+static volatile bool yielded = false;
+
+esp_err_t root_start(const root_config_t *config)
+{
+    esp_err_t err = dns_cache_init(config->host, config->port, config->dns_ttl_ms);
+    if (err == ESP_OK) {
+        err = http_pool_init(config->host, config->port, config->pool_size);
+    }
+    if (err == ESP_OK && upload_queue.items == NULL) {
+        err = msg_queue_init(&upload_queue, upload_slots, upload_stamps, ROOT_QUEUE_LEN);
+        if (err == ESP_OK) {
+            err = msg_queue_init(&critical_queue, critical_slots, critical_stamps, ROOT_CRITICAL_QUEUE_LEN);
+        }
+        if (patient_cache_init(config->persist_patients) != ESP_OK) {
+            ESP_LOGW(TAG, "Known patients could not be restored, starting cold");
+        }
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    uploader_config_t upload = config->upload;
+    upload.host = config->host;
+    upload.store_and_forward = upload.store_and_forward && spool_init() == ESP_OK;
+    spool_enabled = upload.store_and_forward;
+    err = uploader_start(lanes, &upload);
+    if (err == ESP_OK) {
+        yielded = false;
+    }
+    return err;
+}
+
+// Readings that did not reach the next root stay here until this node is root again
+static void root_keep(const mesh_message_t *msgs, size_t count, root_handoff_stats_t *stats)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (spool_enabled && spool_append(&msgs[i]) == ESP_OK) {
+            stats->kept++;
+        } else {
+            stats->lost++;
+        }
+    }
+}
+
+esp_err_t root_yield(handoff_send_fn send, void *ctx, root_handoff_stats_t *stats)
+{
+    esp_err_t err = ESP_OK;
+    size_t count = 0, sent = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    if (upload_queue.items == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    yielded = true;
+    if (uploader_pause(ROOT_HANDOFF_DRAIN_MS) != ESP_OK) {
+        ESP_LOGW(TAG, "Uploads still under way, handing off what is queued");
+    }
+    http_pool_close_all();
+
+    // Alerts first, then routine readings, oldest first within each lane
+    for (int lane = 0; lane < UPLOAD_LANES; lane++) {
+        while (true) {
+            count = 0;
+            while (count < SPOOL_GROUP_MAX && msg_queue_pop(lanes[lane], &handoff_msgs[count], NULL, 0)) {
+                count++;
+            }
+            if (count == 0) {
+                break;
+            }
+            if (err == ESP_OK) {
+                err = handoff_send_readings(send, ctx, handoff_msgs, count, lane == UPLOAD_LANE_CRITICAL, &sent);
+            } else {
+                sent = 0;
+            }
+            stats->readings += sent;
+            root_keep(&handoff_msgs[sent], count - sent, stats);
+        }
+    }
+
+    // Spooled readings follow; a record is only acknowledged once it went out
+    if (spool_enabled && err == ESP_OK) {
+        spool_sync(true);
+        while (err == ESP_OK && spool_has_pending() &&
+                spool_peek(handoff_msgs, SPOOL_GROUP_MAX, &count) == ESP_OK) {
+            err = handoff_send_readings(send, ctx, handoff_msgs, count, false, &sent);
+            // Frames that went out before a failure are not sent again
+            spool_ack(sent);
+            stats->spooled += sent;
+        }
+    }
+
+    if (err == ESP_OK) {
+        err = handoff_send_snapshot(send, ctx, &stats->patients);
+    }
+    if (spool_enabled) {
+        spool_sync(true);
+    }
+    ESP_LOGI(TAG, "Handed off %" PRIu32 " queued and %" PRIu32 " spooled reading(s), %" PRIu32 " known patient(s); "
+             "kept %" PRIu32 ", lost %" PRIu32,
+             stats->readings, stats->spooled, stats->patients, stats->kept, stats->lost);
+    return err;
+}
+
+// Room left in a lane's queue
+static size_t root_queue_room(msg_queue_t *queue)
+{
+    msg_queue_stats_t stats;
+    msg_queue_get_stats(queue, &stats);
+    return stats.capacity - stats.depth;
+}
+
+esp_err_t root_ingest(const uint8_t *frame, size_t len, root_ingest_result_t *result)
+{
+    neo_wire_reader_t reader;
+    neo_reading_t reading;
+    mesh_message_t msg;
+    int count = 0;
+    int64_t start = esp_timer_get_time();
+
+    memset(result, 0, sizeof(*result));
+    if (upload_queue.items == NULL || yielded) {
+        return ESP_ERR_INVALID_STATE; // not root, or no longer
+    }
+    if (handoff_is_snapshot(frame, len)) {
+        return handoff_apply_snapshot(frame, len);
+    }
+    // Check the whole frame before queueing any of it: a damaged frame is dropped whole and its
+    // sequence number is not taken as seen, so the sender's resend gets through
+    esp_err_t err = neo_wire_reader_init(&reader, frame, len);
+    while (err == ESP_OK && (err = neo_wire_next(&reader, &reading)) == ESP_OK) {
+        count++;
+    }
+    if (err != ESP_ERR_NOT_FOUND) {
+        metrics_count(METRIC_BAD_FRAMES);
+        metrics_record_us(METRIC_INGEST, esp_timer_get_time() - start);
+        return err;
+    }
+    // Frames are decoded in place, each reading is copied once into the upload queue
+    neo_wire_reader_init(&reader, frame, len);
+    bool sequenced = (reader.flags & NEO_WIRE_FLAG_SEQUENCED) != 0;
+    bool wants_ack = sequenced && (reader.flags & NEO_WIRE_FLAG_ACK);
+    msg_queue_t *queue = (reader.flags & NEO_WIRE_FLAG_CRITICAL) ? &critical_queue : &upload_queue;
+    if (sequenced) {
+        result->origin = reader.origin;
+        result->seq = reader.seq;
+        if (dedup_seen(reader.origin.ptr, reader.origin.len, reader.seq)) {
+            // Already queued once; acknowledge again in case the first acknowledgement was lost
+            result->ack = wants_ack;
+            result->duplicates = count;
+            metrics_count(METRIC_DUPLICATES);
+            metrics_record_us(METRIC_INGEST, esp_timer_get_time() - start);
+            return ESP_OK;
+        }
+    }
+    if (wants_ack && !spool_enabled && root_queue_room(queue) < (size_t)count) {
+        // The sender resends until acknowledged, so refusing it whole loses nothing
+        ESP_LOGW(TAG, "%s queue full, refused frame of %d reading(s) for a resend",
+                 queue == &critical_queue ? "Critical" : "Upload", count);
+        metrics_record_us(METRIC_INGEST, esp_timer_get_time() - start);
+        return ESP_OK;
+    }
+    while (neo_wire_next(&reader, &reading) == ESP_OK) {
+        neo_reading_to_message(&reading, &msg);
+        if (msg_queue_push(queue, &msg)) {
+            result->queued++;
+        } else if (spool_enabled && spool_append(&msg) == ESP_OK) {
+            // A burst, e.g. a previous root handing over its backlog: keep it for the replay
+            metrics_count(METRIC_OVERFLOW_SPOOLED);
+            result->queued++;
+        } else {
+            ESP_LOGW(TAG, "%s queue full, dropped reading from %s",
+                     queue == &critical_queue ? "Critical" : "Upload", msg.sensor_id);
+        }
+    }
+    // Only a frame stored whole is acknowledged and remembered; otherwise the resend is taken in,
+    // at worst writing its first readings twice rather than losing the rest
+    if (sequenced && (result->queued == count || !wants_ack)) {
+        dedup_accept(reader.origin.ptr, reader.origin.len, reader.seq);
+        result->ack = wants_ack;
+    }
+    metrics_record_us(METRIC_INGEST, esp_timer_get_time() - start);
+    return ESP_OK;
+}
+
+void root_get_queue_stats(upload_lane_t lane, msg_queue_stats_t *stats)
+{
+    if (upload_queue.items == NULL) {
+        memset(stats, 0, sizeof(*stats)); // never root
+        return;
+    }
+    msg_queue_get_stats(lanes[lane], stats);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "handoff.h"
+#include "msg_queue.h"
+#include "neo_wire.h"
+#include "uploader.h"
+
+/* Root node data path: frames received from the mesh are decoded into the upload queue and
+ * written to the API by the uploader tasks. Nothing here touches the mesh itself, so the same
+ * code runs on the board and in the host benchmark (see bench/). */
+#define ROOT_QUEUE_LEN 64 //routine readings buffered between mesh receive and upload
+#define ROOT_CRITICAL_QUEUE_LEN 16 //alerts buffered, each is sent on its own as soon as possible
+#define ROOT_HANDOFF_DRAIN_MS 6000 //longest a yielding root waits for uploads already under way
+
+typedef struct {
+    const char *host;
+    const char *port;
+    uint32_t dns_ttl_ms; //how long a resolved API address is used before it is refreshed
+    int pool_size; //keep-alive connections (max HTTP_POOL_MAX_SIZE)
+    bool persist_patients; //keep known patients in NVS across reboots
+    uploader_config_t upload; //`host` is filled in from above
+} root_config_t;
+
+typedef struct {
+    uint32_t readings; //queued readings sent on to the next root
+    uint32_t spooled; //spooled readings sent on
+    uint32_t patients; //known patients in the cache snapshot
+    uint32_t kept; //readings that could not be sent and stay in the local spool
+    uint32_t lost; //readings that could neither be sent nor spooled
+} root_handoff_stats_t;
+
+typedef struct {
+    int queued; //readings accepted
+    int duplicates; //readings dropped because their frame was seen before, see dedup.h
+    bool ack; //the sender asked for an acknowledgement of `seq` and every reading was stored, or was before
+    neo_str_t origin; //sending node, points into the frame
+    uint32_t seq;
+} root_ingest_result_t;
+
+/* Bring up the DNS cache, connection pool, patient cache, spool and uploader tasks. Called again
+ * after root_yield(), it takes the root role back. */
+esp_err_t root_start(const root_config_t *config);
+
+/* Hand the root role over: stop uploading, then send queued and spooled readings and a snapshot of
+ * the DNS and patient caches through `send` (see handoff.h). From here on root_ingest() refuses
+ * frames; the caller forwards them to the new root instead. */
+esp_err_t root_yield(handoff_send_fn send, void *ctx, root_handoff_stats_t *stats);
+
+/* Decode one mesh frame and queue its readings on the lane its flags ask for. A frame that does not
+ * decode to the end is dropped whole. With store and forward on, readings that find their queue full
+ * are spooled rather than dropped; without it, a frame the sender will resend is refused whole when
+ * its queue has no room for all of it. Sequenced frames seen before are dropped whole. Handoff
+ * snapshots from a previous root are applied to the caches. */
+esp_err_t root_ingest(const uint8_t *frame, size_t len, root_ingest_result_t *result);
+
+void root_get_queue_stats(upload_lane_t lane, msg_queue_stats_t *stats);
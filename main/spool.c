@@ -0,0 +1,462 @@
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "metrics.h"
+#include "neo_wire.h"
+#include "spool.h"
+
+#define SPOOL_SECTOR_SIZE 4096
+#define SPOOL_SECTOR_MAGIC 0x4c4f5053 //"SPOL"
+#define SPOOL_RECORD_MAGIC 0x5253 //"SR"
+#define SPOOL_STATE_PENDING 0xffffffff
+#define SPOOL_STATE_CONSUMED 0
+#define SPOOL_ALIGN(x) (((x) + 3) & ~3u)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq; //grows by one for every sector opened
+} spool_sector_t;
+
+typedef struct {
+    uint16_t magic;
+    uint16_t len; //payload bytes
+    uint32_t crc; //over the payload, seeded with len
+    uint32_t state; //SPOOL_STATE_PENDING shifted left once per reading sent, SPOOL_STATE_CONSUMED once all are
+} spool_record_t;
+
+typedef enum {
+    RECORD_OK,
+    RECORD_END, //erased flash, nothing written here yet
+    RECORD_BAD, //torn or damaged
+} record_status_t;
+
+static const char *TAG = "neoSpool";
+static const esp_partition_t *partition = NULL;
+static SemaphoreHandle_t spool_lock = NULL;
+static uint32_t sectors = 0;
+static uint32_t write_sector, write_offset, write_seq;
+static uint32_t read_sector, read_offset;
+static bool peeked = false;
+static uint32_t peek_len; //payload length of the record handed out by spool_peek
+static size_t peek_count;
+static uint32_t peek_sent; //readings of that record sent before it was peeked
+static mesh_message_t staged[SPOOL_GROUP_MAX];
+static size_t staged_count = 0;
+static int64_t staged_since = 0;
+static int64_t commit_retry_us = 0; //after a failed write, staged readings are not written again before this
+static esp_err_t commit_err = ESP_OK; //outcome of the last write of staged readings
+static uint8_t record_buf[sizeof(spool_record_t) + SPOOL_RECORD_MAX]; //record being written, header and payload
+static uint8_t load_buf[SPOOL_RECORD_MAX]; //payload of the record last read back
+static neo_wire_writer_t writer;
+static spool_stats_t stats = {0};
+
+static uint32_t spool_addr(uint32_t sector, uint32_t offset)
+{
+    return sector * SPOOL_SECTOR_SIZE + offset;
+}
+
+// Read and verify the record at sector/offset, leaving its payload in load_buf
+static record_status_t spool_load(uint32_t sector, uint32_t offset, spool_record_t *rec)
+{
+    if (offset + sizeof(*rec) > SPOOL_SECTOR_SIZE) {
+        return RECORD_END;
+    }
+    if (esp_partition_read(partition, spool_addr(sector, offset), rec, sizeof(*rec)) != ESP_OK) {
+        return RECORD_BAD;
+    }
+    if (rec->magic == 0xffff && rec->len == 0xffff) {
+        return RECORD_END;
+    }
+    if (rec->magic != SPOOL_RECORD_MAGIC || rec->len == 0 || rec->len > SPOOL_RECORD_MAX ||
+            offset + sizeof(*rec) + rec->len > SPOOL_SECTOR_SIZE) {
+        return RECORD_BAD;
+    }
+    if (esp_partition_read(partition, spool_addr(sector, offset) + sizeof(*rec), load_buf, rec->len) != ESP_OK ||
+            esp_rom_crc32_le(rec->len, load_buf, rec->len) != rec->crc) {
+        return RECORD_BAD;
+    }
+    return RECORD_OK;
+}
+
+static uint8_t spool_record_readings(void)
+{
+    return load_buf[4]; // reading count in the neo_wire header
+}
+
+// Readings of a pending record already sent, one cleared state bit each
+static uint32_t spool_record_sent(uint32_t state)
+{
+    return state == SPOOL_STATE_CONSUMED ? 32 : __builtin_ctz(state);
+}
+
+// Program the state word of the record at the read position; NOR flash can only clear bits
+static esp_err_t spool_mark(uint32_t state)
+{
+    return esp_partition_write(partition, spool_addr(read_sector, read_offset) + offsetof(spool_record_t, state),
+                               &state, sizeof(state));
+}
+
+// Move the read position to the oldest pending record, or up to the write position if there is none
+static void spool_skip_consumed(void)
+{
+    spool_record_t rec;
+    while (read_sector != write_sector || read_offset < write_offset) {
+        record_status_t status = spool_load(read_sector, read_offset, &rec);
+        if (status == RECORD_OK) {
+            if (rec.state != SPOOL_STATE_CONSUMED) {
+                return;
+            }
+            read_offset += SPOOL_ALIGN(sizeof(rec) + rec.len);
+            continue;
+        }
+        if (read_sector == write_sector) {
+            read_offset = write_offset;
+            return;
+        }
+        read_sector = (read_sector + 1) % sectors;
+        read_offset = sizeof(spool_sector_t);
+    }
+}
+
+// Readings still pending in a sector, used when the ring wraps onto it
+static uint32_t spool_count_pending(uint32_t sector, uint32_t *records)
+{
+    spool_record_t rec;
+    uint32_t readings = 0;
+    uint32_t offset = sizeof(spool_sector_t);
+    *records = 0;
+    while (spool_load(sector, offset, &rec) == RECORD_OK) {
+        if (rec.state != SPOOL_STATE_CONSUMED) {
+            readings += spool_record_readings() - spool_record_sent(rec.state);
+            (*records)++;
+        }
+        offset += SPOOL_ALIGN(sizeof(rec) + rec.len);
+    }
+    return readings;
+}
+
+static esp_err_t spool_open_sector(uint32_t sector)
+{
+    spool_sector_t header = { .magic = SPOOL_SECTOR_MAGIC, .seq = ++write_seq };
+    esp_err_t err = esp_partition_erase_range(partition, spool_addr(sector, 0), SPOOL_SECTOR_SIZE);
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition, spool_addr(sector, 0), &header, sizeof(header));
+    }
+    write_sector = sector;
+    write_offset = sizeof(header);
+    return err;
+}
+
+static esp_err_t spool_next_sector(void)
+{
+    uint32_t next = (write_sector + 1) % sectors;
+    spool_skip_consumed();
+    if (next == read_sector) {
+        // The ring is full of unsent data: give up the oldest sector
+        uint32_t records;
+        uint32_t lost = spool_count_pending(next, &records);
+        stats.dropped += lost;
+        stats.pending -= records;
+        read_sector = (next + 1) % sectors;
+        read_offset = sizeof(spool_sector_t);
+        peeked = false;
+        ESP_LOGW(TAG, "Spool full, dropped %" PRIu32 " oldest reading(s)", lost);
+    }
+    return spool_open_sector(next);
+}
+
+/* Encode the staged readings into as few records as possible and write them. Readings whose record
+ * could not be written stay staged and are tried again after SPOOL_COMMIT_MS. */
+static esp_err_t spool_commit(void)
+{
+    size_t done = 0;
+    esp_err_t err = ESP_OK;
+    int64_t start = esp_timer_get_time();
+    while (done < staged_count && err == ESP_OK) {
+        size_t n = 0, len = 0;
+        neo_wire_writer_init(&writer, record_buf + sizeof(spool_record_t), SPOOL_RECORD_MAX);
+        while (done + n < staged_count) {
+            neo_value_t value;
+            if (neo_value_parse(staged[done + n].sensor_data, &value) != ESP_OK ||
+                    neo_wire_add(&writer, staged[done + n].sensor_id, staged[done + n].patient_id, &value) != ESP_OK) {
+                break;
+            }
+            n++;
+        }
+        if (n == 0) {
+            // This reading cannot be encoded at all, retrying it would never end
+            stats.dropped++;
+            done++;
+            continue;
+        }
+        neo_wire_finish(&writer, &len);
+
+        spool_record_t rec = {
+            .magic = SPOOL_RECORD_MAGIC,
+            .len = len,
+            .crc = esp_rom_crc32_le(len, record_buf + sizeof(spool_record_t), len),
+            .state = SPOOL_STATE_PENDING,
+        };
+        memcpy(record_buf, &rec, sizeof(rec));
+        size_t size = sizeof(rec) + len;
+        if (write_offset + SPOOL_ALIGN(size) > SPOOL_SECTOR_SIZE) {
+            err = spool_next_sector();
+        }
+        if (err == ESP_OK) {
+            // Header and payload in one write: a torn write always fails the CRC
+            err = esp_partition_write(partition, spool_addr(write_sector, write_offset), record_buf, size);
+        }
+        if (err != ESP_OK) {
+            // Never reuse the space of a failed write, and close the sector: a hole would stop the
+            // replay before the records written after it
+            write_offset = SPOOL_SECTOR_SIZE;
+        } else {
+            write_offset += SPOOL_ALIGN(size);
+            stats.commits++;
+            stats.bytes_written += size;
+            stats.pending++;
+            done += n;
+        }
+    }
+    if (done > 0) {
+        metrics_record_us(METRIC_SPOOL, esp_timer_get_time() - start);
+    }
+    staged_count -= done;
+    memmove(staged, &staged[done], staged_count * sizeof(staged[0]));
+    commit_err = err;
+    if (err != ESP_OK) {
+        commit_retry_us = esp_timer_get_time() + SPOOL_COMMIT_MS * 1000LL;
+        ESP_LOGE(TAG, "Writing spool record failed, %d reading(s) kept in RAM: %s", (int)staged_count,
+                 esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t spool_init(void)
+{
+    if (spool_lock != NULL) {
+        return ESP_OK;
+    }
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SPOOL_PARTITION);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "No \"%s\" partition, store-and-forward disabled", SPOOL_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    sectors = partition->size / SPOOL_SECTOR_SIZE;
+    if (sectors < 2 || sizeof(spool_record_t) + SPOOL_RECORD_MAX > SPOOL_SECTOR_SIZE - sizeof(spool_sector_t)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    spool_lock = xSemaphoreCreateMutex();
+    if (spool_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // The newest sector is written next, the oldest is replayed first
+    int newest = -1, oldest = -1;
+    uint32_t newest_seq = 0, oldest_seq = 0;
+    for (uint32_t s = 0; s < sectors; s++) {
+        spool_sector_t header;
+        if (esp_partition_read(partition, spool_addr(s, 0), &header, sizeof(header)) != ESP_OK ||
+                header.magic != SPOOL_SECTOR_MAGIC) {
+            continue;
+        }
+        if (newest < 0 || header.seq > newest_seq) {
+            newest = s;
+            newest_seq = header.seq;
+        }
+        if (oldest < 0 || header.seq < oldest_seq) {
+            oldest = s;
+            oldest_seq = header.seq;
+        }
+    }
+    if (newest < 0) {
+        write_seq = 0;
+        esp_err_t err = spool_open_sector(0);
+        read_sector = 0;
+        read_offset = write_offset;
+        ESP_LOGI(TAG, "Formatted %" PRIu32 " sector(s)", sectors);
+        return err;
+    }
+
+    write_seq = newest_seq;
+    write_sector = newest;
+    read_sector = oldest;
+    read_offset = sizeof(spool_sector_t);
+    // Count what is left to send and find the end of the newest sector
+    for (uint32_t s = oldest; ; s = (s + 1) % sectors) {
+        spool_record_t rec;
+        uint32_t offset = sizeof(spool_sector_t);
+        record_status_t status;
+        while ((status = spool_load(s, offset, &rec)) == RECORD_OK) {
+            if (rec.state != SPOOL_STATE_CONSUMED) {
+                stats.pending++;
+            }
+            offset += SPOOL_ALIGN(sizeof(rec) + rec.len);
+        }
+        if (status == RECORD_BAD) {
+            stats.corrupt++;
+        }
+        if (s == (uint32_t)newest) {
+            // After a torn record, continue in a fresh sector rather than next to it
+            write_offset = status == RECORD_BAD ? SPOOL_SECTOR_SIZE : offset;
+            break;
+        }
+    }
+    spool_skip_consumed();
+    ESP_LOGI(TAG, "%" PRIu32 " record(s) waiting to be sent, %" PRIu32 " damaged", stats.pending, stats.corrupt);
+    return ESP_OK;
+}
+
+esp_err_t spool_append(const mesh_message_t *msg)
+{
+    if (spool_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(spool_lock, portMAX_DELAY);
+    if (staged_count == SPOOL_GROUP_MAX) {
+        // Still full after failed writes: make room by giving up the oldest reading
+        memmove(staged, &staged[1], (SPOOL_GROUP_MAX - 1) * sizeof(staged[0]));
+        staged_count--;
+        stats.dropped++;
+        ESP_LOGW(TAG, "Spool cannot be written, dropped the oldest staged reading");
+    }
+    if (staged_count == 0) {
+        staged_since = esp_timer_get_time();
+    }
+    staged[staged_count++] = *msg;
+    stats.appended++;
+    // A failed write keeps the group staged for the next try, so this reading is not lost with it
+    if (staged_count == SPOOL_GROUP_MAX && esp_timer_get_time() >= commit_retry_us) {
+        spool_commit();
+    }
+    xSemaphoreGive(spool_lock);
+    return ESP_OK;
+}
+
+esp_err_t spool_sync(bool force)
+{
+    if (spool_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(spool_lock, portMAX_DELAY);
+    int64_t now = esp_timer_get_time();
+    if (staged_count > 0 && (force || (now - staged_since >= SPOOL_COMMIT_MS * 1000LL && now >= commit_retry_us))) {
+        err = spool_commit();
+    }
+    xSemaphoreGive(spool_lock);
+    return err;
+}
+
+bool spool_has_pending(void)
+{
+    if (spool_lock == NULL) {
+        return false;
+    }
+    xSemaphoreTake(spool_lock, portMAX_DELAY);
+    bool pending = stats.pending > 0 || staged_count > 0;
+    xSemaphoreGive(spool_lock);
+    return pending;
+}
+
+esp_err_t spool_peek(mesh_message_t *msgs, size_t max, size_t *count)
+{
+    if (spool_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (max < SPOOL_GROUP_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    spool_record_t rec;
+    *count = 0;
+    xSemaphoreTake(spool_lock, portMAX_DELAY);
+    // Replay what is still in RAM too, once it is on flash
+    if (staged_count > 0) {
+        err = esp_timer_get_time() >= commit_retry_us ? spool_commit() : commit_err;
+        if (err != ESP_OK) {
+            xSemaphoreGive(spool_lock);
+            return err;
+        }
+    }
+    err = ESP_ERR_NOT_FOUND;
+    spool_skip_consumed();
+    while ((read_sector != write_sector || read_offset < write_offset) &&
+            spool_load(read_sector, read_offset, &rec) == RECORD_OK) {
+        neo_wire_reader_t reader;
+        neo_reading_t reading;
+        uint32_t skip = spool_record_sent(rec.state);
+        if (neo_wire_reader_init(&reader, load_buf, rec.len) != ESP_OK) {
+            // Intact but unreadable, e.g. written by firmware with another frame version: it would
+            // block the replay for good, so it is given up
+            ESP_LOGW(TAG, "Dropped a spool record that cannot be decoded");
+            spool_mark(SPOOL_STATE_CONSUMED);
+            read_offset += SPOOL_ALIGN(sizeof(rec) + rec.len);
+            stats.pending--;
+            stats.corrupt++;
+            stats.dropped += spool_record_readings();
+            spool_skip_consumed();
+            continue;
+        }
+        // Readings sent by an earlier, interrupted replay are not handed out again
+        while (*count < max && neo_wire_next(&reader, &reading) == ESP_OK) {
+            if (skip > 0) {
+                skip--;
+            } else {
+                neo_reading_to_message(&reading, &msgs[(*count)++]);
+            }
+        }
+        peeked = true;
+        peek_len = rec.len;
+        peek_count = *count;
+        peek_sent = spool_record_sent(rec.state);
+        err = ESP_OK;
+        break;
+    }
+    xSemaphoreGive(spool_lock);
+    return err;
+}
+
+esp_err_t spool_ack(size_t sent)
+{
+    if (spool_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(spool_lock, portMAX_DELAY);
+    // peeked is cleared if the ring wrapped over the record in the meantime
+    if (peeked) {
+        if (sent >= peek_count) {
+            sent = peek_count;
+            err = spool_mark(SPOOL_STATE_CONSUMED);
+            read_offset += SPOOL_ALIGN(sizeof(spool_record_t) + peek_len);
+            stats.pending--;
+        } else if (sent > 0) {
+            // The rest stays pending; what went out is remembered across a reset
+            err = spool_mark(SPOOL_STATE_PENDING << (peek_sent + sent));
+        } else {
+            err = ESP_OK;
+        }
+        stats.replayed += sent;
+        peeked = false;
+    }
+    xSemaphoreGive(spool_lock);
+    return err;
+}
+
+void spool_get_stats(spool_stats_t *out)
+{
+    if (spool_lock == NULL) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    xSemaphoreTake(spool_lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(spool_lock);
+}
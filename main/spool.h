@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "neolink.h"
+
+/* Store-and-forward log for readings that could not be uploaded.
+ *
+ * Records are appended to the sectors of a raw data partition used as a ring. Each sector starts
+ * with a header carrying a sequence number, so the oldest and newest sectors are found again after
+ * a reboot. A record holds a group of readings encoded as a neo_wire frame, protected by a CRC32;
+ * a record torn by a reset fails its CRC and the rest of that sector is skipped. Replayed records
+ * are marked consumed by clearing their state word in place, which NOR flash allows without an
+ * erase; a record replayed in part has one bit cleared per reading sent, so those are not sent
+ * again, even after a reset. Readings are grouped in RAM for up to SPOOL_COMMIT_MS, so at most one
+ * flash write is made per SPOOL_GROUP_MAX readings. */
+#define SPOOL_PARTITION "spool" //label in partitions.csv
+#define SPOOL_GROUP_MAX 8 //readings per flash record
+#define SPOOL_RECORD_MAX 1024 //largest encoded record
+#define SPOOL_COMMIT_MS 2000 //longest a reading stays in RAM before it is written
+
+typedef struct {
+    uint32_t appended; //readings handed to the spool
+    uint32_t commits; //records written
+    uint32_t bytes_written;
+    uint32_t replayed; //readings read back and acknowledged
+    uint32_t pending; //records waiting on flash
+    uint32_t dropped; //readings lost: the log wrapped onto unsent data or they could not be encoded or decoded
+    uint32_t corrupt; //torn, damaged or undecodable records skipped
+} spool_stats_t;
+
+esp_err_t spool_init(void);
+
+/* Queue a reading for a later upload. The reading is kept in RAM until its group is written; if a
+ * flash write fails the group stays there and is tried again, and only once SPOOL_GROUP_MAX readings
+ * are waiting is the oldest dropped (counted in `dropped`). */
+esp_err_t spool_append(const mesh_message_t *msg);
+
+/* Write grouped readings to flash if the oldest has waited SPOOL_COMMIT_MS, or now with `force`.
+ * After a failed write the next try waits another SPOOL_COMMIT_MS unless forced. */
+esp_err_t spool_sync(bool force);
+
+bool spool_has_pending(void);
+
+/* Read the readings of the oldest record that have not been sent yet. They stay in the spool until
+ * spool_ack(). Readings still in RAM are written first, and an error doing so is returned. A record
+ * that cannot be decoded is dropped and counted as corrupt. */
+esp_err_t spool_peek(mesh_message_t *msgs, size_t max, size_t *count);
+
+/* Mark the first `sent` readings returned by the last spool_peek() as sent. The record is consumed
+ * once all of them are; otherwise the next spool_peek() returns the rest. */
+esp_err_t spool_ack(size_t sent);
+
+void spool_get_stats(spool_stats_t *stats);
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "budget.h"
+#include "trace.h"
+
+#define TRACE_TOPOLOGY_MAGIC 0x7A0C1E55
+#define TRACE_STACK 3072
+
+typedef struct {
+    const char *format; //printf format for the MAC (when `mac`) followed by the three arguments
+    bool mac;
+    bool topology; //also kept in the post-mortem ring
+} trace_format_t;
+
+typedef struct {
+    uint32_t magic; //TRACE_TOPOLOGY_MAGIC once initialised, anything else after a power cycle
+    uint32_t head; //next slot to write
+    trace_record_t records[TRACE_TOPOLOGY_LEN];
+} trace_topology_t;
+
+static const char *TAG = "neoTrace";
+static const trace_format_t formats[TRACE_EVENTS] = {
+    [TRACE_MESH_STARTED] = { "<MESH_EVENT_MESH_STARTED>ID:"MACSTR, true, true },
+    [TRACE_MESH_STOPPED] = { "<MESH_EVENT_STOPPED>", false, true },
+    [TRACE_CHILD_CONNECTED] = { "<MESH_EVENT_CHILD_CONNECTED>"MACSTR", aid:%d", true, true },
+    [TRACE_CHILD_DISCONNECTED] = { "<MESH_EVENT_CHILD_DISCONNECTED>"MACSTR", aid:%d", true, true },
+    [TRACE_ROUTING_ADD] = { "<MESH_EVENT_ROUTING_TABLE_ADD>add %d, new:%d, layer:%d", false, true },
+    [TRACE_ROUTING_REMOVE] = { "<MESH_EVENT_ROUTING_TABLE_REMOVE>remove %d, new:%d, layer:%d", false, true },
+    [TRACE_NO_PARENT] = { "<MESH_EVENT_NO_PARENT_FOUND>scan times:%d", false, true },
+    [TRACE_PARENT_CONNECTED] = { "<MESH_EVENT_PARENT_CONNECTED>parent:"MACSTR", layer:%d-->%d, duty:%d", true, true },
+    [TRACE_PARENT_DISCONNECTED] = { "<MESH_EVENT_PARENT_DISCONNECTED>reason:%d", false, true },
+    [TRACE_LAYER_CHANGE] = { "<MESH_EVENT_LAYER_CHANGE>layer:%d-->%d", false, true },
+    [TRACE_ROOT_ADDRESS] = { "<MESH_EVENT_ROOT_ADDRESS>root address:"MACSTR, true, true },
+    [TRACE_VOTE_STARTED] = { "<MESH_EVENT_VOTE_STARTED>rc_addr:"MACSTR", attempts:%d, reason:%d", true, true },
+    [TRACE_VOTE_STOPPED] = { "<MESH_EVENT_VOTE_STOPPED>", false, true },
+    [TRACE_ROOT_SWITCH_REQ] = { "<MESH_EVENT_ROOT_SWITCH_REQ>rc_addr:"MACSTR", reason:%d", true, true },
+    [TRACE_ROOT_SWITCH_ACK] = { "<MESH_EVENT_ROOT_SWITCH_ACK>parent:"MACSTR", layer:%d", true, true },
+    [TRACE_TODS_STATE] = { "<MESH_EVENT_TODS_REACHABLE>state:%d", false, false },
+    [TRACE_ROOT_FIXED] = { "<MESH_EVENT_ROOT_FIXED>fixed:%d", false, false },
+    [TRACE_ROOT_ASKED_YIELD] = { "<MESH_EVENT_ROOT_ASKED_YIELD>"MACSTR", rssi:%d, capacity:%d", true, true },
+    [TRACE_CHANNEL_SWITCH] = { "<MESH_EVENT_CHANNEL_SWITCH>new channel:%d", false, true },
+    [TRACE_SCAN_DONE] = { "<MESH_EVENT_SCAN_DONE>number:%d", false, false },
+    [TRACE_NETWORK_STATE] = { "<MESH_EVENT_NETWORK_STATE>is_rootless:%d", false, true },
+    [TRACE_STOP_RECONNECTION] = { "<MESH_EVENT_STOP_RECONNECTION>", false, true },
+    [TRACE_FIND_NETWORK] = { "<MESH_EVENT_FIND_NETWORK>router BSSID:"MACSTR", new channel:%d", true, false },
+    [TRACE_ROUTER_SWITCH] = { "<MESH_EVENT_ROUTER_SWITCH>"MACSTR", channel:%d", true, true },
+    [TRACE_PS_PARENT_DUTY] = { "<MESH_EVENT_PS_PARENT_DUTY>duty:%d", false, false },
+    [TRACE_PS_CHILD_DUTY] = { "<MESH_EVENT_PS_CHILD_DUTY>"MACSTR", aid:%d, duty:%d", true, false },
+    [TRACE_MESH_UNKNOWN] = { "unknown mesh event id:%d", false, false },
+    [TRACE_FRAME_IN] = { "frame from "MACSTR": %d bytes, %d queued, %d duplicates", true, false },
+    [TRACE_READING_OUT] = { "reading dequeued from lane %d after %d ms", false, false },
+    [TRACE_UPSERT] = { "upsert (patient existed:%d) returned %d on task %d", false, false },
+    [TRACE_BATCH] = { "bulk upload of %d readings (flush reason %d) returned %d", false, false },
+};
+static trace_record_t ring[TRACE_RING_LEN];
+static uint32_t head = 0; //next record to write
+static uint32_t tail = 0; //next record to format
+static RTC_NOINIT_ATTR trace_topology_t topology;
+static bool topology_ready = false;
+static trace_stats_t stats = {0};
+static TaskHandle_t trace_task_handle = NULL;
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+_Static_assert((TRACE_RING_LEN & (TRACE_RING_LEN - 1)) == 0, "TRACE_RING_LEN must be a power of two");
+_Static_assert((TRACE_TOPOLOGY_LEN & (TRACE_TOPOLOGY_LEN - 1)) == 0, "TRACE_TOPOLOGY_LEN must be a power of two");
+
+void trace_record(trace_event_t event, const uint8_t *mac, int32_t a0, int32_t a1, int32_t a2)
+{
+    trace_record_t record = {
+        .us = esp_timer_get_time(),
+        .event = event,
+        .args = { a0, a1, a2 },
+    };
+    if (mac != NULL) {
+        memcpy(record.mac, mac, sizeof(record.mac));
+    }
+
+    portENTER_CRITICAL(&trace_lock);
+    if (head - tail == TRACE_RING_LEN) {
+        tail++; // full, the oldest record is lost
+        stats.dropped++;
+    }
+    ring[head++ & (TRACE_RING_LEN - 1)] = record;
+    stats.recorded++;
+    bool wake = head - tail == TRACE_RING_LEN / 2;
+    if (topology_ready && event < TRACE_EVENTS && formats[event].topology) {
+        topology.records[topology.head++ & (TRACE_TOPOLOGY_LEN - 1)] = record;
+    }
+    portEXIT_CRITICAL(&trace_lock);
+    if (wake && trace_task_handle != NULL) {
+        xTaskNotifyGive(trace_task_handle);
+    }
+}
+
+static void trace_format(const trace_record_t *r, const char *prefix)
+{
+    char line[160];
+    if (r->event >= TRACE_EVENTS || formats[r->event].format == NULL) {
+        ESP_LOGW(TAG, "%s%" PRId64 " ms: event %d", prefix, r->us / 1000, r->event);
+        return;
+    }
+    const trace_format_t *f = &formats[r->event];
+    if (f->mac) {
+        snprintf(line, sizeof(line), f->format, MAC2STR(r->mac), r->args[0], r->args[1], r->args[2]);
+    } else {
+        snprintf(line, sizeof(line), f->format, r->args[0], r->args[1], r->args[2]);
+    }
+    ESP_LOGI(TAG, "%s%" PRId64 " ms: %s", prefix, r->us / 1000, line);
+}
+
+void trace_flush(void)
+{
+    trace_record_t record;
+    while (true) {
+        portENTER_CRITICAL(&trace_lock);
+        bool pending = tail != head;
+        if (pending) {
+            record = ring[tail++ & (TRACE_RING_LEN - 1)];
+            stats.formatted++;
+        }
+        portEXIT_CRITICAL(&trace_lock);
+        if (!pending) {
+            return;
+        }
+        trace_format(&record, "");
+    }
+}
+
+size_t trace_export_topology(trace_record_t *records, size_t max)
+{
+    size_t count = 0;
+    portENTER_CRITICAL(&trace_lock);
+    if (topology_ready) {
+        uint32_t n = topology.head < TRACE_TOPOLOGY_LEN ? topology.head : TRACE_TOPOLOGY_LEN;
+        for (uint32_t i = topology.head - n; i != topology.head && count < max; i++) {
+            records[count++] = topology.records[i & (TRACE_TOPOLOGY_LEN - 1)];
+        }
+    }
+    portEXIT_CRITICAL(&trace_lock);
+    return count;
+}
+
+void trace_dump_topology(void)
+{
+    static trace_record_t records[TRACE_TOPOLOGY_LEN]; //only one dump at a time is useful anyway
+    size_t count = trace_export_topology(records, TRACE_TOPOLOGY_LEN);
+    for (size_t i = 0; i < count; i++) {
+        trace_format(&records[i], "topology ");
+    }
+}
+
+static void trace_task(void *arg)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TRACE_FLUSH_MS));
+        trace_flush();
+    }
+}
+
+esp_err_t trace_start(void)
+{
+    if (trace_task_handle != NULL) {
+        return ESP_OK;
+    }
+    // RTC memory keeps its contents over a panic or software reset, not over a power cycle
+    bool survived = topology.magic == TRACE_TOPOLOGY_MAGIC;
+    if (!survived) {
+        memset(&topology, 0, sizeof(topology));
+        topology.magic = TRACE_TOPOLOGY_MAGIC;
+    }
+    portENTER_CRITICAL(&trace_lock);
+    topology_ready = true;
+    portEXIT_CRITICAL(&trace_lock);
+    if (survived && topology.head > 0) {
+        ESP_LOGW(TAG, "Topology events before the last reset (times from that boot):");
+        trace_dump_topology();
+    }
+    if (xTaskCreate(trace_task, "neoTrace", TRACE_STACK, NULL, 1, &trace_task_handle) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    budget_watch(trace_task_handle, TRACE_STACK);
+    return ESP_OK;
+}
+
+void trace_get_stats(trace_stats_t *out)
+{
+    portENTER_CRITICAL(&trace_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&trace_lock);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Deferred binary trace. Recording copies an event ID, a timestamp, an optional MAC address and up
+ * to three integers into a ring under a spinlock; nothing is formatted on the caller's stack. A
+ * low-priority task formats pending records in the background, so the mesh event loop and the
+ * upload path never wait for the UART. When the ring overflows the oldest unformatted records are
+ * dropped and counted.
+ * Topology events (parent, layer, routing table and root changes) are also kept in a second ring
+ * in RTC memory, which survives a panic or software reset and is printed on the next boot. */
+#define TRACE_RING_LEN 128 //records waiting to be formatted, power of two
+#define TRACE_TOPOLOGY_LEN 32 //most recent topology records kept for post-mortems, power of two
+#define TRACE_FLUSH_MS 1000 //how often the task formats pending records, sooner once the ring is half full
+
+typedef enum {
+    TRACE_MESH_STARTED, //mac: mesh ID
+    TRACE_MESH_STOPPED,
+    TRACE_CHILD_CONNECTED, //mac: child, aid
+    TRACE_CHILD_DISCONNECTED, //mac: child, aid
+    TRACE_ROUTING_ADD, //added, new size, layer
+    TRACE_ROUTING_REMOVE, //removed, new size, layer
+    TRACE_NO_PARENT, //scan times
+    TRACE_PARENT_CONNECTED, //mac: parent, old layer, new layer, duty
+    TRACE_PARENT_DISCONNECTED, //reason
+    TRACE_LAYER_CHANGE, //old layer, new layer
+    TRACE_ROOT_ADDRESS, //mac: root
+    TRACE_VOTE_STARTED, //mac: root candidate, attempts, reason
+    TRACE_VOTE_STOPPED,
+    TRACE_ROOT_SWITCH_REQ, //mac: root candidate, reason
+    TRACE_ROOT_SWITCH_ACK, //mac: parent, layer
+    TRACE_TODS_STATE, //state
+    TRACE_ROOT_FIXED, //fixed
+    TRACE_ROOT_ASKED_YIELD, //mac: other root, rssi, capacity
+    TRACE_CHANNEL_SWITCH, //channel
+    TRACE_SCAN_DONE, //networks found
+    TRACE_NETWORK_STATE, //rootless
+    TRACE_STOP_RECONNECTION,
+    TRACE_FIND_NETWORK, //mac: router, channel
+    TRACE_ROUTER_SWITCH, //mac: router, channel
+    TRACE_PS_PARENT_DUTY, //duty
+    TRACE_PS_CHILD_DUTY, //mac: child, aid, duty
+    TRACE_MESH_UNKNOWN, //event ID
+    TRACE_FRAME_IN, //mac: sender, bytes, readings queued, duplicates
+    TRACE_READING_OUT, //lane, ms queued
+    TRACE_UPSERT, //patient existed, HTTP status, uploader task
+    TRACE_BATCH, //readings, flush reason, HTTP status
+    TRACE_EVENTS,
+} trace_event_t;
+
+typedef struct {
+    int64_t us; //esp_timer time, topology records may be from an earlier boot
+    uint16_t event; //trace_event_t
+    uint8_t mac[6];
+    int32_t args[3];
+} trace_record_t;
+
+typedef struct {
+    uint32_t recorded;
+    uint32_t formatted;
+    uint32_t dropped; //overwritten before they were formatted
+} trace_stats_t;
+
+/* Start the formatting task and print the topology records left by the previous boot. */
+esp_err_t trace_start(void);
+
+/* `mac` may be NULL. Safe from any task, never blocks. */
+void trace_record(trace_event_t event, const uint8_t *mac, int32_t a0, int32_t a1, int32_t a2);
+
+/* Format pending records now, e.g. before a planned restart. */
+void trace_flush(void);
+
+/* Log the recent topology records, oldest first. */
+void trace_dump_topology(void);
+
+/* Copy up to `max` recent topology records, oldest first. Returns the count. */
+size_t trace_export_topology(trace_record_t *records, size_t max);
+
+void trace_get_stats(trace_stats_t *stats);
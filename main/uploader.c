@@ -0,0 +1,597 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "budget.h"
+#include "deflate.h"
+#include "dns_cache.h"
+#include "http_pool.h"
+#include "http_request.h"
+#include "metrics.h"
+#include "patient_cache.h"
+#include "spool.h"
+#include "trace.h"
+#include "uploader.h"
+
+#define UPLOADER_ALERT_TASK UPLOADER_MAX_TASKS //index of the task draining the critical lane
+#define UPLOADER_STACK 4096
+
+static const char *TAG = "neoUpload";
+static msg_queue_t *upload_lanes[UPLOAD_LANES];
+static uploader_config_t upload_config;
+static batch_t batches[UPLOADER_MAX_TASKS]; //one batch per routine uploader task
+static http_request_t requests[UPLOADER_MAX_TASKS + 1]; //per task, heads point into it while sending
+static char upsert_bodies[UPLOADER_MAX_TASKS + 1][BATCH_READING_MAX];
+static deflate_scratch_t deflate_scratch[UPLOADER_MAX_TASKS]; //bulk bodies are only compressed by routine tasks
+static uint8_t deflated_bodies[UPLOADER_MAX_TASKS][BATCH_MAX_BYTES];
+static bool bulk_supported = true; //cleared when the API has no bulk endpoint, under stats_lock
+static bool deflate_supported = true; //cleared when the API refuses a Content-Encoding, under stats_lock
+static batch_t replay_batch;
+static mesh_message_t replay_msgs[SPOOL_GROUP_MAX];
+static int64_t uplink_retry_us = 0; //while in the future, uploads go straight to the spool
+static bool paused = false;
+static uint32_t idle_tasks = 0; //bit per task that has seen the pause and holds no readings
+static uploader_stats_t stats = {0};
+static char metrics_line[768]; //only written by the task logging stats
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Server trouble is worth retrying later, any other refusal is final
+static esp_err_t uploader_status_err(int status)
+{
+    return (status >= 500 || status == 408 || status == 429) ? ESP_FAIL : ESP_ERR_INVALID_RESPONSE;
+}
+
+static bool uploader_retryable(esp_err_t err)
+{
+    return err != ESP_OK && err != ESP_ERR_INVALID_RESPONSE;
+}
+
+static bool uplink_is_down(void)
+{
+    portENTER_CRITICAL(&stats_lock);
+    bool down = esp_timer_get_time() < uplink_retry_us;
+    portEXIT_CRITICAL(&stats_lock);
+    return down;
+}
+
+static void uplink_failed(void)
+{
+    portENTER_CRITICAL(&stats_lock);
+    uplink_retry_us = esp_timer_get_time() + UPLOADER_RETRY_MS * 1000LL;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+// What the API turned out to support, shared by every uploader task
+static bool uploader_supports(const bool *feature)
+{
+    portENTER_CRITICAL(&stats_lock);
+    bool supported = *feature;
+    portEXIT_CRITICAL(&stats_lock);
+    return supported;
+}
+
+static void uploader_unsupported(bool *feature)
+{
+    portENTER_CRITICAL(&stats_lock);
+    *feature = false;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static bool uploader_is_paused(int index, bool idle)
+{
+    portENTER_CRITICAL(&stats_lock);
+    bool is_paused = paused;
+    if (is_paused && idle) {
+        idle_tasks |= 1u << index;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    return is_paused;
+}
+
+// Keep readings for a later replay. Returns false if they are lost.
+static bool uploader_spool(const mesh_message_t *items, size_t count)
+{
+    size_t spooled = 0;
+    if (upload_config.store_and_forward) {
+        while (spooled < count && spool_append(&items[spooled]) == ESP_OK) {
+            spooled++;
+        }
+    }
+    portENTER_CRITICAL(&stats_lock);
+    stats.spooled += spooled;
+    stats.failed += count - spooled;
+    portEXIT_CRITICAL(&stats_lock);
+    return spooled == count;
+}
+
+// POST a new patient or PATCH an existing one with the already encoded reading
+static esp_err_t uploader_write(int index, const mesh_message_t *received, bool patient_exists,
+                                const char *body, size_t body_len, int *status)
+{
+    http_request_t *request = &requests[index];
+    const char *method = patient_exists ? "PATCH" : "POST";
+    esp_err_t err = http_request_build(request, method, upload_config.host, upload_config.path,
+                                       patient_exists ? received->patient_id : NULL, body, body_len, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s request for %s does not fit", method, received->patient_id);
+        return err;
+    }
+
+    int64_t start = esp_timer_get_time();
+    err = http_pool_request(request, index == UPLOADER_ALERT_TASK, status);
+    metrics_record_us(METRIC_WRITE, esp_timer_get_time() - start);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s failed", method);
+        return err;
+    }
+    trace_record(TRACE_UPSERT, NULL, patient_exists, *status, index);
+    return ESP_OK;
+}
+
+// Write one reading: PATCH the patient if it exists or POST it otherwise
+static esp_err_t uploader_send(int index, const mesh_message_t *received)
+{
+    char *body = upsert_bodies[index];
+    size_t body_len = 0;
+    int status = 0;
+
+    // The JSON body is encoded once and used for whichever request ends up being sent
+    esp_err_t err = batch_encode_reading(received, body, sizeof(upsert_bodies[index]), &body_len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Reading from %s does not fit a request", received->sensor_id);
+        return err;
+    }
+
+    // Only ask the API whether the patient exists when the cache does not know
+    patient_state_t state = patient_cache_lookup(received->patient_id);
+    if (state == PATIENT_UNKNOWN) {
+        err = http_request_build(&requests[index], "GET", upload_config.host, upload_config.path,
+                                 received->patient_id, NULL, 0, NULL);
+        if (err != ESP_OK) {
+            return err;
+        }
+        int64_t start = esp_timer_get_time();
+        err = http_pool_request(&requests[index], index == UPLOADER_ALERT_TASK, &status);
+        metrics_record_us(METRIC_GET, esp_timer_get_time() - start);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "GET %s/%s failed", upload_config.path, received->patient_id);
+            return err;
+        }
+        if (status == 200) {
+            state = PATIENT_EXISTS;
+        } else if (status == 404) {
+            state = PATIENT_ABSENT;
+        } else {
+            ESP_LOGE(TAG, "GET %s/%s returned %d", upload_config.path, received->patient_id, status);
+            return uploader_status_err(status);
+        }
+    }
+
+    err = uploader_write(index, received, state == PATIENT_EXISTS, body, body_len, &status);
+    if (err == ESP_OK && state == PATIENT_EXISTS && status == 404) {
+        // Deleted since we cached it, create it again
+        patient_cache_invalidate(received->patient_id);
+        state = PATIENT_ABSENT;
+        metrics_count(METRIC_RETRIES);
+        err = uploader_write(index, received, false, body, body_len, &status);
+    } else if (err == ESP_OK && state == PATIENT_ABSENT && status == 409) {
+        // Created by someone else since we cached it as missing
+        state = PATIENT_EXISTS;
+        metrics_count(METRIC_RETRIES);
+        err = uploader_write(index, received, true, body, body_len, &status);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (status < 200 || status >= 300) {
+        ESP_LOGE(TAG, "Upload for %s returned %d", received->patient_id, status);
+        patient_cache_invalidate(received->patient_id);
+        return uploader_status_err(status);
+    }
+    // Whether it was patched or just created, the patient exists now
+    patient_cache_store(received->patient_id, PATIENT_EXISTS);
+    return ESP_OK;
+}
+
+// Time from reaching the root to being acknowledged by the API, per lane
+static void uploader_record_lane(int index, int64_t queued_us)
+{
+    if (queued_us > 0) {
+        metrics_record_us(index == UPLOADER_ALERT_TASK ? METRIC_LANE_CRITICAL : METRIC_LANE_ROUTINE,
+                          esp_timer_get_time() - queued_us);
+    }
+}
+
+/* Upsert readings one at a time. A reading that fails in a way worth retrying is spooled when
+ * `spool_failed` is set, and so is everything after it. `queued_us` (may be NULL) holds when each
+ * reading reached the root. Returns how many leading readings were sent or finally rejected, less
+ * than `count` if the rest was not sent. */
+static size_t uploader_send_each(int index, const mesh_message_t *items, const int64_t *queued_us,
+                                 size_t count, bool spool_failed)
+{
+    for (size_t i = 0; i < count; i++) {
+        esp_err_t err = uploader_send(index, &items[i]);
+        if (uploader_retryable(err)) {
+            uplink_failed();
+            if (spool_failed) {
+                uploader_spool(&items[i], count - i);
+            }
+            return i;
+        }
+        portENTER_CRITICAL(&stats_lock);
+        if (err == ESP_OK) {
+            stats.upserts++;
+            stats.alerts += index == UPLOADER_ALERT_TASK;
+        } else {
+            stats.failed++;
+        }
+        portEXIT_CRITICAL(&stats_lock);
+        if (err == ESP_OK) {
+            uploader_record_lane(index, queued_us != NULL ? queued_us[i] : 0);
+        }
+    }
+    return count;
+}
+
+/* Compress a bulk body when it is long enough and gets shorter, see deflate.h. Points `body` and
+ * `len` at what is to be sent and returns its Content-Encoding, NULL when it goes as it is. */
+static const char *uploader_deflate(int index, const char **body, size_t *len)
+{
+    size_t deflated_len = 0;
+    if (upload_config.encoding == DEFLATE_NONE || !uploader_supports(&deflate_supported) || *len == 0 ||
+            *len < upload_config.compress_min) {
+        return NULL;
+    }
+    uint32_t start = metrics_stamp();
+    esp_err_t err = deflate_encode(upload_config.encoding, *body, *len, &deflate_scratch[index],
+                                   deflated_bodies[index], *len - 1, &deflated_len);
+    metrics_record(METRIC_DEFLATE, start);
+    portENTER_CRITICAL(&stats_lock);
+    if (err == ESP_OK) {
+        stats.deflated++;
+        stats.deflate_in += *len;
+        stats.deflate_out += deflated_len;
+    } else {
+        stats.incompressible++;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    if (err != ESP_OK) {
+        return NULL;
+    }
+    *body = (const char *)deflated_bodies[index];
+    *len = deflated_len;
+    return deflate_content_encoding(upload_config.encoding);
+}
+
+static esp_err_t uploader_bulk_post(int index, const char *body, size_t body_len, const char *encoding, int *status)
+{
+    esp_err_t err = http_request_build(&requests[index], "POST", upload_config.host, upload_config.bulk_path,
+                                       NULL, body, body_len, encoding);
+    if (err == ESP_OK) {
+        int64_t start = esp_timer_get_time();
+        err = http_pool_request(&requests[index], false, status);
+        metrics_record_us(METRIC_BULK, esp_timer_get_time() - start);
+    }
+    return err;
+}
+
+/* Send the whole batch as one bulk POST, falling back to per-patient upserts if the API refuses it.
+ * While the uplink is down the batch goes straight to the spool when `spool_failed` is set.
+ * Returns how many leading readings were sent or finally rejected, as uploader_send_each(). */
+static size_t uploader_flush(int index, batch_t *batch, batch_flush_reason_t reason, bool spool_failed)
+{
+    if (batch->count == 0) {
+        return 0;
+    }
+    portENTER_CRITICAL(&stats_lock);
+    stats.flushes[reason]++;
+    portEXIT_CRITICAL(&stats_lock);
+    if (reason != BATCH_FLUSH_REPLAY) {
+        metrics_record_us(METRIC_BATCH, esp_timer_get_time() - batch->first_us);
+    }
+
+    size_t done = 0;
+    if (spool_failed && upload_config.store_and_forward && uplink_is_down()) {
+        uploader_spool(batch->items, batch->count);
+        batch_reset(batch);
+        return 0;
+    }
+
+    if (upload_config.bulk_path != NULL && uploader_supports(&bulk_supported)) {
+        int status = 0;
+        const char *body = batch->body;
+        size_t raw_len = batch_finish(batch);
+        size_t body_len = raw_len;
+        // The batch body goes out as it is or compressed, only the head is formatted
+        const char *encoding = uploader_deflate(index, &body, &body_len);
+        esp_err_t err = uploader_bulk_post(index, body, body_len, encoding, &status);
+        if (err == ESP_OK && status == 415 && encoding != NULL) {
+            // The API does not take this Content-Encoding: this body and every later one go as they are
+            ESP_LOGW(TAG, "Compressed upload not supported (%d), sending bodies as they are", status);
+            uploader_unsupported(&deflate_supported);
+            err = uploader_bulk_post(index, batch->body, raw_len, NULL, &status);
+        }
+        if (err == ESP_OK && status >= 200 && status < 300) {
+            done = batch->count;
+            portENTER_CRITICAL(&stats_lock);
+            stats.batches++;
+            stats.batched_readings += batch->count;
+            if (batch->count > stats.largest_batch) {
+                stats.largest_batch = batch->count;
+            }
+            portEXIT_CRITICAL(&stats_lock);
+            // The bulk endpoint upserts, so every patient in the batch exists now
+            for (size_t i = 0; i < batch->count; i++) {
+                patient_cache_store(batch->items[i].patient_id, PATIENT_EXISTS);
+                uploader_record_lane(index, batch->queued_us[i]);
+            }
+            trace_record(TRACE_BATCH, NULL, batch->count, reason, status);
+        } else if (err == ESP_OK && (status == 404 || status == 405 || status == 501)) {
+            // No bulk endpoint on this server, upsert patients one at a time from now on
+            ESP_LOGW(TAG, "Bulk upload not supported (%d), using per-patient upserts", status);
+            uploader_unsupported(&bulk_supported);
+        } else if (err != ESP_OK || uploader_retryable(uploader_status_err(status))) {
+            // The uplink or the API is down, trying each reading now would only fail slower
+            ESP_LOGE(TAG, "Bulk upload of %d readings failed (%d)", (int)batch->count, err == ESP_OK ? status : err);
+            uplink_failed();
+            if (spool_failed) {
+                uploader_spool(batch->items, batch->count);
+            }
+            batch_reset(batch);
+            return 0;
+        } else {
+            ESP_LOGE(TAG, "Bulk upload of %d readings rejected (%d)", (int)batch->count, status);
+        }
+    }
+
+    if (done == 0) {
+        done = uploader_send_each(index, batch->items, batch->queued_us, batch->count, spool_failed);
+    }
+    batch_reset(batch);
+    return done;
+}
+
+/* Send the oldest spooled record once the uplink is back. Returns true if all of it was sent. When
+ * only part of it goes out, that part is acknowledged so the next replay does not write it twice. */
+static bool uploader_replay(void)
+{
+    size_t count = 0, sent = 0;
+    if (!spool_has_pending() || uplink_is_down() ||
+            spool_peek(replay_msgs, SPOOL_GROUP_MAX, &count) != ESP_OK) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!batch_add(&replay_batch, &replay_msgs[i], 0, esp_timer_get_time())) {
+            // Does not fit the byte limit: replay the record one reading at a time
+            batch_reset(&replay_batch);
+            break;
+        }
+    }
+    if (replay_batch.count > 0) {
+        sent = uploader_flush(0, &replay_batch, BATCH_FLUSH_REPLAY, false);
+    } else {
+        sent = uploader_send_each(0, replay_msgs, NULL, count, false);
+    }
+    spool_ack(sent);
+    portENTER_CRITICAL(&stats_lock);
+    stats.replayed += sent;
+    portEXIT_CRITICAL(&stats_lock);
+    return sent == count;
+}
+
+static void uploader_task(void *arg)
+{
+    int index = (int)(intptr_t)arg;
+    batch_t *batch = &batches[index];
+    mesh_message_t msg;
+    int64_t waited_us = 0;
+    int64_t next_stats = esp_timer_get_time() + UPLOADER_STATS_MS * 1000LL;
+    int64_t max_delay_us = upload_config.batch_delay_ms * 1000LL;
+    bool replaying = false;
+
+    batch_init(batch, upload_config.batch_bytes);
+    if (index == 0) {
+        batch_init(&replay_batch, upload_config.batch_bytes);
+    }
+    while (true) {
+        // Sleep no longer than the oldest batched reading may still wait
+        TickType_t wait = pdMS_TO_TICKS(1000);
+        if (replaying) {
+            wait = 0; // keep draining the spool while nothing new arrives
+        } else if (batch->count > 0) {
+            int64_t left_us = batch->first_us + max_delay_us - esp_timer_get_time();
+            wait = left_us > 0 ? pdMS_TO_TICKS(left_us / 1000) : 0;
+        }
+        if (uploader_is_paused(index, batch->count == 0)) {
+            // Let the batch run out its delay, then hold nothing until resumed
+            vTaskDelay(wait < pdMS_TO_TICKS(UPLOADER_PAUSE_POLL_MS) ? wait : pdMS_TO_TICKS(UPLOADER_PAUSE_POLL_MS));
+            replaying = false;
+        } else if (msg_queue_pop(upload_lanes[UPLOAD_LANE_ROUTINE], &msg, &waited_us, wait)) {
+            metrics_record_us(METRIC_QUEUE, waited_us);
+            int64_t queued_us = esp_timer_get_time() - waited_us;
+            trace_record(TRACE_READING_OUT, NULL, UPLOAD_LANE_ROUTINE, waited_us / 1000, 0);
+            if (upload_config.bulk_path == NULL || !uploader_supports(&bulk_supported)) {
+                if (upload_config.store_and_forward && uplink_is_down()) {
+                    uploader_spool(&msg, 1);
+                } else {
+                    uploader_send_each(index, &msg, &queued_us, 1, true);
+                }
+            } else {
+                if (!batch_add(batch, &msg, queued_us, esp_timer_get_time())) {
+                    uploader_flush(index, batch, BATCH_FLUSH_BYTES, true);
+                    if (!batch_add(batch, &msg, queued_us, esp_timer_get_time())) {
+                        // Larger than a whole batch once escaped, send it on its own
+                        uploader_send_each(index, &msg, &queued_us, 1, true);
+                    }
+                }
+                if (batch->count >= upload_config.batch_items) {
+                    uploader_flush(index, batch, BATCH_FLUSH_ITEMS, true);
+                }
+            }
+        }
+        if (batch->count > 0 && esp_timer_get_time() - batch->first_us >= max_delay_us) {
+            uploader_flush(index, batch, BATCH_FLUSH_TIMEOUT, true);
+        }
+        // A single task commits, replays and reports for all of them
+        if (index == 0 && upload_config.store_and_forward && !uploader_is_paused(index, false)) {
+            spool_sync(false);
+            replaying = uploader_replay();
+        }
+        if (index == 0 && esp_timer_get_time() >= next_stats) {
+            uploader_log_stats();
+            patient_cache_save();
+            next_stats += UPLOADER_STATS_MS * 1000LL;
+        }
+    }
+}
+
+/* Alerts skip batching and the uplink backoff: each one is tried at once on the reserved
+ * connection and only spooled if that fails. */
+static void uploader_alert_task(void *arg)
+{
+    mesh_message_t msg;
+    int64_t waited_us = 0;
+
+    while (true) {
+        if (uploader_is_paused(UPLOADER_ALERT_TASK, true)) {
+            vTaskDelay(pdMS_TO_TICKS(UPLOADER_PAUSE_POLL_MS));
+            continue;
+        }
+        if (msg_queue_pop(upload_lanes[UPLOAD_LANE_CRITICAL], &msg, &waited_us, pdMS_TO_TICKS(UPLOADER_PAUSE_POLL_MS))) {
+            int64_t queued_us = esp_timer_get_time() - waited_us;
+            trace_record(TRACE_READING_OUT, NULL, UPLOAD_LANE_CRITICAL, waited_us / 1000, 0);
+            uploader_send_each(UPLOADER_ALERT_TASK, &msg, &queued_us, 1, true);
+        }
+    }
+}
+
+esp_err_t uploader_start(msg_queue_t *lanes[UPLOAD_LANES], const uploader_config_t *config)
+{
+    static bool is_started = false;
+    if (is_started) {
+        portENTER_CRITICAL(&stats_lock);
+        paused = false;
+        idle_tasks = 0;
+        portEXIT_CRITICAL(&stats_lock);
+        return ESP_OK;
+    }
+    if (lanes == NULL || lanes[UPLOAD_LANE_CRITICAL] == NULL || lanes[UPLOAD_LANE_ROUTINE] == NULL || config == NULL || config->host == NULL || config->path == NULL ||
+            config->tasks < 1 || config->tasks > UPLOADER_MAX_TASKS ||
+            config->batch_items < 1 || config->batch_items > BATCH_MAX_ITEMS ||
+            config->batch_bytes < sizeof(mesh_message_t) + 64 || config->batch_bytes > BATCH_MAX_BYTES ||
+            config->encoding > DEFLATE_GZIP) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Every request head must fit, even a PATCH for a patient ID that is escaped throughout
+    char worst_id[PATIENT_ID_LEN];
+    memset(worst_id, ' ', sizeof(worst_id) - 1);
+    worst_id[sizeof(worst_id) - 1] = '\0';
+    if (http_request_build(&requests[0], "PATCH", config->host, config->path, worst_id, "", BATCH_READING_MAX, NULL) != ESP_OK ||
+            (config->bulk_path != NULL &&
+             http_request_build(&requests[0], "POST", config->host, config->bulk_path, NULL, "", BATCH_MAX_BYTES,
+                                deflate_content_encoding(config->encoding)) != ESP_OK)) {
+        ESP_LOGE(TAG, "Host and paths are too long for a %d byte request head", HTTP_REQUEST_HEAD_MAX);
+        return ESP_ERR_INVALID_ARG;
+    }
+    upload_lanes[UPLOAD_LANE_CRITICAL] = lanes[UPLOAD_LANE_CRITICAL];
+    upload_lanes[UPLOAD_LANE_ROUTINE] = lanes[UPLOAD_LANE_ROUTINE];
+    upload_config = *config;
+    // Above the routine tasks so an alert is sent as soon as it arrives. Left free to run on either
+    // core; its request spans are timed with esp_timer, see metrics.h
+    TaskHandle_t task = NULL;
+    if (xTaskCreate(uploader_alert_task, "neoAlert", UPLOADER_STACK, NULL, 6, &task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    budget_watch(task, UPLOADER_STACK);
+    for (int i = 0; i < config->tasks; i++) {
+        BaseType_t core = config->pin_cores ? i % portNUM_PROCESSORS : tskNO_AFFINITY;
+        if (xTaskCreatePinnedToCore(uploader_task, "neoUpload", UPLOADER_STACK, (void *)(intptr_t)i, 5, &task, core) != pdPASS) {
+            return ESP_ERR_NO_MEM;
+        }
+        budget_watch(task, UPLOADER_STACK);
+    }
+    is_started = true;
+    ESP_LOGI(TAG, "%d uploader task(s) started%s, batching %s, compression %s", config->tasks,
+             config->pin_cores ? " (pinned)" : "", config->bulk_path ? "on" : "off",
+             config->encoding != DEFLATE_NONE ? deflate_content_encoding(config->encoding) : "off");
+    return ESP_OK;
+}
+
+esp_err_t uploader_pause(uint32_t wait_ms)
+{
+    uint32_t all = ((1u << upload_config.tasks) - 1) | (1u << UPLOADER_ALERT_TASK);
+    int64_t deadline = esp_timer_get_time() + wait_ms * 1000LL;
+
+    portENTER_CRITICAL(&stats_lock);
+    paused = true;
+    portEXIT_CRITICAL(&stats_lock);
+    while (true) {
+        portENTER_CRITICAL(&stats_lock);
+        bool idle = (idle_tasks & all) == all;
+        portEXIT_CRITICAL(&stats_lock);
+        if (idle) {
+            return ESP_OK;
+        }
+        if (esp_timer_get_time() >= deadline) {
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(pdMS_TO_TICKS(UPLOADER_PAUSE_POLL_MS));
+    }
+}
+
+void uploader_get_stats(uploader_stats_t *out)
+{
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void uploader_log_stats(void)
+{
+    static const char *lane_names[UPLOAD_LANES] = { "critical", "routine" };
+    msg_queue_stats_t queue_stats;
+    http_pool_stats_t pool_stats;
+    uploader_stats_t upload_stats;
+    patient_cache_stats_t cache_stats;
+    dns_cache_stats_t dns_stats;
+    spool_stats_t spool_stats;
+    char flushes[80];
+    http_pool_get_stats(&pool_stats);
+    uploader_get_stats(&upload_stats);
+    patient_cache_get_stats(&cache_stats);
+    dns_cache_get_stats(&dns_stats);
+    spool_get_stats(&spool_stats);
+    for (int lane = 0; lane < UPLOAD_LANES; lane++) {
+        msg_queue_get_stats(upload_lanes[lane], &queue_stats);
+        ESP_LOGI(TAG, "%s queue: depth:%" PRIu32 "/%" PRIu32 ", high-water:%" PRIu32 ", pushed:%" PRIu32 ", dropped:%" PRIu32,
+                 lane_names[lane], queue_stats.depth, queue_stats.capacity, queue_stats.high_water,
+                 queue_stats.pushed, queue_stats.dropped);
+    }
+    int len = 0;
+    for (int reason = 0; reason < BATCH_FLUSH_REASONS; reason++) {
+        len += snprintf(flushes + len, sizeof(flushes) - len, "%s%s:%" PRIu32, reason > 0 ? ", " : "",
+                        batch_flush_reason_str(reason), upload_stats.flushes[reason]);
+    }
+    ESP_LOGI(TAG, "batches:%" PRIu32 ", readings:%" PRIu32 ", largest:%" PRIu32 ", flushes (%s), upserts:%" PRIu32 ", alerts:%" PRIu32 ", failed:%" PRIu32,
+             upload_stats.batches, upload_stats.batched_readings, upload_stats.largest_batch, flushes,
+             upload_stats.upserts, upload_stats.alerts, upload_stats.failed);
+    ESP_LOGI(TAG, "deflate: bodies:%" PRIu32 ", bytes in/out:%" PRIu32 "/%" PRIu32 ", incompressible:%" PRIu32,
+             upload_stats.deflated, upload_stats.deflate_in, upload_stats.deflate_out, upload_stats.incompressible);
+    ESP_LOGI(TAG, "spool: spooled:%" PRIu32 ", replayed:%" PRIu32 ", pending records:%" PRIu32 ", commits:%" PRIu32 ", flash bytes:%" PRIu32 ", dropped:%" PRIu32 ", corrupt:%" PRIu32,
+             upload_stats.spooled, upload_stats.replayed, spool_stats.pending, spool_stats.commits,
+             spool_stats.bytes_written, spool_stats.dropped, spool_stats.corrupt);
+    ESP_LOGI(TAG, "patients: hits:%" PRIu32 ", negative:%" PRIu32 ", misses:%" PRIu32 ", expired:%" PRIu32 ", evicted:%" PRIu32 ", invalidated:%" PRIu32,
+             cache_stats.hits, cache_stats.negative_hits, cache_stats.misses, cache_stats.expired,
+             cache_stats.evictions, cache_stats.invalidations);
+    ESP_LOGI(TAG, "dns: hits:%" PRIu32 ", misses:%" PRIu32 ", stale:%" PRIu32 ", refreshes:%" PRIu32 ", refresh failures:%" PRIu32,
+             dns_stats.hits, dns_stats.misses, dns_stats.stale, dns_stats.refreshes, dns_stats.refresh_failures);
+    ESP_LOGI(TAG, "pool: requests:%" PRIu32 ", reused:%" PRIu32 ", handshakes:%" PRIu32 ", reconnects:%" PRIu32 ", failures:%" PRIu32,
+             pool_stats.requests, pool_stats.reused, pool_stats.handshakes,
+             pool_stats.reconnects, pool_stats.failures);
+    // stage:count/p50/p99/max in us, see metrics.h
+    metrics_format(metrics_line, sizeof(metrics_line));
+    ESP_LOGI(TAG, "metrics: %s", metrics_line);
+}
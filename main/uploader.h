@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "msg_queue.h"
+#include "batcher.h"
+#include "deflate.h"
+
+#define UPLOADER_MAX_TASKS 4
+#define UPLOADER_STATS_MS 30000 //how often queue and connection counters are logged
+#define UPLOADER_RETRY_MS 10000 //after an uplink failure, readings are spooled this long before the next attempt
+#define UPLOADER_PAUSE_POLL_MS 50 //how often paused tasks check whether they may go on
+
+/* Readings reach the uploader through one queue per lane. Critical readings (alerts, see
+ * NEO_WIRE_FLAG_CRITICAL) have their own task and a reserved pool connection and are never batched. */
+typedef enum {
+    UPLOAD_LANE_CRITICAL,
+    UPLOAD_LANE_ROUTINE,
+    UPLOAD_LANES,
+} upload_lane_t;
+
+typedef struct {
+    const char *host;
+    const char *path; //per-patient resource, readings are upserted at <path>/<patient_id>
+    const char *bulk_path; //endpoint taking a JSON array of readings, NULL to upload one by one
+    int tasks; //uploader tasks draining the routine queue, the critical lane has a task of its own
+    bool pin_cores; //pin task i to core i % portNUM_PROCESSORS
+    size_t batch_items; //flush after this many readings (max BATCH_MAX_ITEMS)
+    size_t batch_bytes; //flush before the JSON body would exceed this (max BATCH_MAX_BYTES)
+    uint32_t batch_delay_ms; //flush once the oldest reading has waited this long
+    bool store_and_forward; //spool readings that could not be sent, see spool.h
+    deflate_format_t encoding; //Content-Encoding for bulk bodies, DEFLATE_NONE to send them as they are
+    size_t compress_min; //bulk bodies shorter than this are always sent as they are
+} uploader_config_t;
+
+typedef struct {
+    uint32_t batches; //bulk requests sent
+    uint32_t batched_readings; //readings carried by those requests
+    uint32_t largest_batch;
+    uint32_t flushes[BATCH_FLUSH_REASONS]; //why each batch was sent
+    uint32_t upserts; //readings written one patient at a time
+    uint32_t alerts; //critical readings written, also counted in upserts
+    uint32_t spooled; //readings kept in flash for a later replay
+    uint32_t replayed; //spooled readings sent once the uplink was back
+    uint32_t failed; //readings that were rejected or lost
+    uint32_t deflated; //bulk bodies sent compressed
+    uint32_t deflate_in; //their length before compression
+    uint32_t deflate_out; //and after
+    uint32_t incompressible; //bodies sent as they are because compressing did not make them shorter
+} uploader_stats_t;
+
+/* Start the uploader tasks draining one queue per lane. Once started, calling it again resumes
+ * tasks paused by uploader_pause(). */
+esp_err_t uploader_start(msg_queue_t *lanes[UPLOAD_LANES], const uploader_config_t *config);
+
+/* Stop taking readings from the queues and spool, e.g. before handing the root role over.
+ * Batches already taken are still flushed. Waits up to `wait_ms` for every task to go idle and
+ * returns ESP_ERR_TIMEOUT if one is still busy. */
+esp_err_t uploader_pause(uint32_t wait_ms);
+
+void uploader_get_stats(uploader_stats_t *stats);
+
+/* Log queue depth, drops, high-water mark, batching and HTTP connection reuse. */
+void uploader_log_stats(void);